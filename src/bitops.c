@@ -0,0 +1,244 @@
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BITOPS_X86 1
+#endif
+#include "bitops.h"
+
+/*-----------------------------Kernels-------------------------*/
+/* The AVX2 and POPCNT kernels are always compiled on x86-64 and picked at
+ * run time from the CPU features, so a default build ships them. A build
+ * with -mavx2 -mpopcnt skips the check. */
+#if defined(BITOPS_X86)
+#if defined(__AVX2__) && defined(__POPCNT__)
+#define bitmapHaveAVX2() 1
+#define bitmapHavePOPCNT() 1
+#else
+static int bitmapCpu = -1;      /* Bit 0: POPCNT, bit 1: AVX2 and POPCNT. */
+
+static int bitmapCpuFeatures(void){
+    if(bitmapCpu == -1){
+        int popcnt;
+
+        __builtin_cpu_init();
+        popcnt = __builtin_cpu_supports("popcnt") != 0;
+        bitmapCpu = popcnt | ((popcnt && __builtin_cpu_supports("avx2")) << 1);
+    }
+    return bitmapCpu;
+}
+#define bitmapHaveAVX2() (bitmapCpuFeatures() & 2)
+#define bitmapHavePOPCNT() (bitmapCpuFeatures() & 1)
+#endif
+#endif
+
+static inline long long bitmapPopcountWords(const unsigned char *p, size_t count, size_t j){
+    //count from byte j to the end a word at a time, inlined in the kernels
+    //below so that __builtin_popcountll() becomes POPCNT there
+    long long bits = 0;
+
+    for(; j+8 <= count; j += 8){
+        uint64_t w;
+        memcpy(&w, p+j, 8);
+        bits += __builtin_popcountll(w);
+    }
+    for(; j < count; j++){
+        bits += __builtin_popcount(p[j]);
+    }
+    return bits;
+}
+
+#if defined(BITOPS_X86)
+__attribute__((target("popcnt")))
+static long long bitmapPopcountPOPCNT(const unsigned char *p, size_t count){
+    return bitmapPopcountWords(p, count, 0);
+}
+
+__attribute__((target("avx2,popcnt")))
+static long long bitmapPopcountAVX2(const unsigned char *p, size_t count){
+    //nibble lookup popcount, the per byte counts are summed with vpsadbw
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t j;
+
+    for(j = 0; j+32 <= count; j += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p+j));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+           _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3) +
+           bitmapPopcountWords(p, count, j);
+}
+
+__attribute__((target("avx2")))
+static size_t bitmapOpAVX2(unsigned char *d, int op, sds *src, int numkeys, size_t minlen){
+    //combine the 32 byte blocks of [0,minlen), returns the bytes done
+    size_t j;
+    int k;
+
+    for(j = 0; j+32 <= minlen; j += 32){
+        __m256i acc = _mm256_loadu_si256((const __m256i *)(src[0]+j));
+        for(k = 1; k < numkeys; k++){
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src[k]+j));
+            switch(op){
+            case BITOP_AND: acc = _mm256_and_si256(acc, v); break;
+            case BITOP_OR: acc = _mm256_or_si256(acc, v); break;
+            case BITOP_XOR: acc = _mm256_xor_si256(acc, v); break;
+            }
+        }
+        if(op == BITOP_NOT) acc = _mm256_xor_si256(acc, _mm256_set1_epi8(-1));
+        _mm256_storeu_si256((__m256i *)(d+j), acc);
+    }
+    return j;
+}
+#endif
+
+long long bitmapPopcount(const void *s, size_t count){
+    //number of set bits in the first count bytes of s
+    const unsigned char *p = s;
+
+#if defined(BITOPS_X86)
+    if(bitmapHaveAVX2()) return bitmapPopcountAVX2(p, count);
+    if(bitmapHavePOPCNT()) return bitmapPopcountPOPCNT(p, count);
+#endif
+    return bitmapPopcountWords(p, count, 0);
+}
+
+long long bitmapBitpos(const void *s, size_t count, int bit){
+    //position of the first bit set to 'bit' in the first count bytes.
+    //When no such bit exists, -1 is returned looking for 1, and count*8
+    //looking for 0, since the string is virtually padded with zeros.
+    const unsigned char *p = s;
+    uint64_t skipword = bit ? 0 : UINT64_MAX;
+    unsigned char skipbyte = bit ? 0 : 0xff;
+    size_t j = 0;
+
+    //skip the words with nothing to find, then locate the byte
+    for(; j+8 <= count; j += 8){
+        uint64_t w;
+        memcpy(&w, p+j, 8);
+        if(w != skipword) break;
+    }
+    for(; j < count; j++){
+        if(p[j] != skipbyte){
+            unsigned int c = bit ? p[j] : (unsigned char)~p[j];
+            return (long long)j*8 + (__builtin_clz(c)-24);
+        }
+    }
+    return bit ? -1 : (long long)count*8;
+}
+
+/*-----------------------------APIs-------------------------*/
+static int bitmapNormalizeRange(size_t len, long *start, long *end){
+    //BITCOUNT/BITPOS byte range rules, returns 0 if the range is empty
+    if(*start < 0) *start += len;
+    if(*end < 0) *end += len;
+    if(*start < 0) *start = 0;
+    if(*end < 0) *end = 0;
+    if(*end >= (long)len) *end = len-1;
+    return len > 0 && *start <= *end;
+}
+
+sds bitmapSetBit(sds s, size_t bitoffset, int on, int *oldbit){
+    //SETBIT: the string is zero extended to cover bitoffset
+    size_t byte = bitoffset >> 3;
+    int bit = 7 - (bitoffset & 7);
+
+    s = sdsgrowzero(s, byte+1);
+    if(s == NULL) return NULL;
+    if(oldbit) *oldbit = (s[byte] >> bit) & 1;
+    s[byte] = (s[byte] & ~(1 << bit)) | ((on ? 1 : 0) << bit);
+    return s;
+}
+
+int bitmapGetBit(const sds s, size_t bitoffset){
+    size_t byte = bitoffset >> 3;
+
+    if(byte >= sdslen(s)) return 0;
+    return (s[byte] >> (7 - (bitoffset & 7))) & 1;
+}
+
+long long bitmapCount(const sds s, long start, long end){
+    //BITCOUNT over the inclusive byte range [start,end]
+    if(!bitmapNormalizeRange(sdslen(s), &start, &end)) return 0;
+    return bitmapPopcount(s+start, end-start+1);
+}
+
+long long bitmapPos(const sds s, int bit, long start, long end, int end_given){
+    //BITPOS over the inclusive byte range [start,end]
+    long long pos;
+    size_t len = sdslen(s);
+
+    if(len == 0) return bit ? -1 : 0;
+    if(!end_given) end = len-1;
+    if(!bitmapNormalizeRange(len, &start, &end)) return -1;
+    pos = bitmapBitpos(s+start, end-start+1, bit);
+    //looking for a 0 past an explicit end is not a match
+    if(end_given && bit == 0 && pos == (long long)(end-start+1)*8) return -1;
+    if(pos != -1) pos += (long long)start*8;
+    return pos;
+}
+
+sds bitmapOp(sds dest, int op, sds *src, int numkeys){
+    //BITOP: combine src into dest in a single pass. dest is reserved once
+    //for the longest source; shorter sources read as zero padded. dest must
+    //not be one of the sources.
+    size_t maxlen = 0, minlen = (size_t)-1, j = 0;
+    unsigned char *d;
+    int k;
+
+    assert(numkeys > 0 && (op != BITOP_NOT || numkeys == 1));
+    for(k = 0; k < numkeys; k++){
+        size_t len = sdslen(src[k]);
+        assert(src[k] != dest);
+        if(len > maxlen) maxlen = len;
+        if(len < minlen) minlen = len;
+    }
+    if(dest == NULL) dest = sdsempty();
+    sdsclear(dest);
+    dest = sdsMakeRoomFor(dest, maxlen);
+    if(dest == NULL) return NULL;
+    d = (unsigned char *)dest;
+
+    //every source covers [0,minlen): combine full words
+#if defined(BITOPS_X86)
+    if(bitmapHaveAVX2()) j = bitmapOpAVX2(d, op, src, numkeys, minlen);
+#endif
+    for(; j+8 <= minlen; j += 8){
+        uint64_t acc, v;
+        memcpy(&acc, src[0]+j, 8);
+        for(k = 1; k < numkeys; k++){
+            memcpy(&v, src[k]+j, 8);
+            switch(op){
+            case BITOP_AND: acc &= v; break;
+            case BITOP_OR: acc |= v; break;
+            case BITOP_XOR: acc ^= v; break;
+            }
+        }
+        if(op == BITOP_NOT) acc = ~acc;
+        memcpy(d+j, &acc, 8);
+    }
+    //tail: bytes past the end of a source are zero
+    for(; j < maxlen; j++){
+        unsigned char acc = j < sdslen(src[0]) ? src[0][j] : 0;
+        for(k = 1; k < numkeys; k++){
+            unsigned char v = j < sdslen(src[k]) ? src[k][j] : 0;
+            switch(op){
+            case BITOP_AND: acc &= v; break;
+            case BITOP_OR: acc |= v; break;
+            case BITOP_XOR: acc ^= v; break;
+            }
+        }
+        if(op == BITOP_NOT) acc = ~acc;
+        d[j] = acc;
+    }
+    sdsIncrLen(dest, maxlen);
+    return dest;
+}
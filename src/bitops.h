@@ -0,0 +1,23 @@
+#ifndef __BITOPS_H
+#define __BITOPS_H
+
+#include "xsds.h"
+
+/* Bitmaps are plain sds values. Bit 0 is the most significant bit of the
+ * first byte, and reads past the end of the string see zero bits. */
+
+#define BITOP_AND 0
+#define BITOP_OR 1
+#define BITOP_XOR 2
+#define BITOP_NOT 3
+
+long long bitmapPopcount(const void *s, size_t count);
+long long bitmapBitpos(const void *s, size_t count, int bit);
+
+sds bitmapSetBit(sds s, size_t bitoffset, int on, int *oldbit);
+int bitmapGetBit(const sds s, size_t bitoffset);
+long long bitmapCount(const sds s, long start, long end);
+long long bitmapPos(const sds s, int bit, long start, long end, int end_given);
+sds bitmapOp(sds dest, int op, sds *src, int numkeys);
+
+#endif /* __BITOPS_H */
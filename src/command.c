@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command.h"
+#include "zmalloc.h"
+#include "latency.h"
+
+/* The command table. Lookups go through a perfect hash built from this
+ * table once at startup, so dispatching a request costs one hash of the
+ * command name, one probe and one case-insensitive compare. */
+static struct subaruCommand commandTable[] = {
+    {"get",2,"rF",0,NULL,-1,NULL},
+    {"set",-3,"wm",0,NULL,-1,NULL},
+    {"incr",2,"wmF",0,NULL,-1,NULL},
+    {"append",3,"wm",0,NULL,-1,NULL},
+    {"strlen",2,"rF",0,NULL,-1,NULL},
+    {"setrange",4,"wm",0,NULL,-1,NULL},
+    {"getrange",4,"r",0,NULL,-1,NULL},
+    {"setbit",4,"wm",0,NULL,-1,NULL},
+    {"getbit",3,"rF",0,NULL,-1,NULL},
+    {"bitcount",-2,"r",0,NULL,-1,NULL},
+    {"bitpos",-3,"r",0,NULL,-1,NULL},
+    {"bitop",-4,"wm",0,NULL,-1,NULL},
+    {"pfadd",-2,"wmF",0,NULL,-1,NULL},
+    {"pfcount",-2,"r",0,NULL,-1,NULL},
+    {"pfmerge",-2,"wm",0,NULL,-1,NULL},
+    {"lpush",-3,"wmF",0,NULL,-1,NULL},
+    {"zadd",-4,"wm",0,NULL,-1,NULL},
+    {"del",-2,"w",0,NULL,-1,NULL},
+    {"exists",-2,"rF",0,NULL,-1,NULL},
+    {"expire",3,"wF",0,NULL,-1,NULL},
+    {"ttl",2,"rF",0,NULL,-1,NULL},
+    {"persist",2,"wF",0,NULL,-1,NULL},
+    {"ping",-1,"rF",0,NULL,-1,NULL},
+    {"info",-1,"r",0,NULL,-1,NULL}
+};
+
+#define COMMAND_TABLE_LEN (sizeof(commandTable)/sizeof(commandTable[0]))
+#define COMMAND_SEED_TRIES 4096
+
+static struct subaruCommand **commandSlots = NULL;
+static unsigned int commandSlotsMask = 0;
+static unsigned int commandSeed = 0;
+
+/* Try to place every command in a table of mask+1 slots hashing with 'seed'.
+ * Returns 1 if no two commands collide, 0 otherwise. */
+static int commandTryPlace(struct subaruCommand **slots, unsigned int mask,
+                           unsigned int seed)
+{
+    size_t j;
+
+    memset(slots,0,sizeof(*slots)*(mask+1));
+    for (j = 0; j < COMMAND_TABLE_LEN; j++) {
+        unsigned int idx = sdscasehash(commandTable[j].sname,seed) & mask;
+        if (slots[idx]) return 0;
+        slots[idx] = commandTable+j;
+    }
+    return 1;
+}
+
+/* Parse the flags and search a seed that maps the command table to a
+ * collision free power of two table. The table starts at twice the number
+ * of commands and is doubled whenever no seed is found. */
+void commandTableInit(void) {
+    unsigned int size = 1, seed;
+    size_t j;
+
+    for (j = 0; j < COMMAND_TABLE_LEN; j++) {
+        struct subaruCommand *c = commandTable+j;
+        char *f = c->sflags, evname[64];
+
+        c->sname = sdsnew(c->name);
+        snprintf(evname,sizeof(evname),"cmd_%s",c->name);
+        c->latency_event = latencyRegisterEvent(evname);
+        c->flags = 0;
+        while (*f) {
+            switch(*f) {
+            case 'w': c->flags |= CMD_WRITE; break;
+            case 'r': c->flags |= CMD_READONLY; break;
+            case 'm': c->flags |= CMD_DENYOOM; break;
+            case 'F': c->flags |= CMD_FAST; break;
+            default:
+                fprintf(stderr,"Unsupported command flag '%c' for '%s'\n",
+                    *f,c->name);
+                exit(1);
+            }
+            f++;
+        }
+    }
+
+    while (size < COMMAND_TABLE_LEN*2) size <<= 1;
+    while (1) {
+        commandSlots = zrealloc(commandSlots,sizeof(*commandSlots)*size);
+        for (seed = 0; seed < COMMAND_SEED_TRIES; seed++) {
+            if (commandTryPlace(commandSlots,size-1,seed)) {
+                commandSlotsMask = size-1;
+                commandSeed = seed;
+                return;
+            }
+        }
+        size <<= 1;
+    }
+}
+
+struct subaruCommand *lookupCommand(sds name) {
+    struct subaruCommand *c;
+
+    c = commandSlots[sdscasehash(name,commandSeed) & commandSlotsMask];
+    if (c == NULL || sdslen(c->sname) != sdslen(name) ||
+        sdscasecmp(c->sname,name) != 0) return NULL;
+    return c;
+}
+
+struct subaruCommand *lookupCommandByCString(char *name) {
+    struct subaruCommand *c;
+    sds sname = sdsnew(name);
+
+    c = lookupCommand(sname);
+    sdsfree(sname);
+    return c;
+}
+
+/* Install the implementation of a command, so that the table stays free of
+ * dependencies on the modules implementing them. Returns -1 if there is
+ * no such command. */
+int commandSetProc(char *name, subaruCommandProc *proc) {
+    struct subaruCommand *cmd = lookupCommandByCString(name);
+
+    if (cmd == NULL) return -1;
+    cmd->proc = proc;
+    return 0;
+}
+
+/* Execute a command on behalf of client 'c'. Every command dispatch goes
+ * through here, so its duration is recorded in the latency histogram of
+ * the command when tracking is enabled. */
+void call(struct subaruCommand *cmd, void *c) {
+    uint64_t start;
+
+    latencyStartSample(start);
+    cmd->proc(c);
+    latencyEndSample(cmd->latency_event,start);
+}
@@ -0,0 +1,30 @@
+#ifndef __COMMAND_H
+#define __COMMAND_H
+
+#include "xsds.h"
+
+/* Command flags, one char each in the sflags string of the table. */
+#define CMD_WRITE 1         /* "w" flag */
+#define CMD_READONLY 2      /* "r" flag */
+#define CMD_DENYOOM 4       /* "m" flag */
+#define CMD_FAST 8          /* "F" flag */
+
+typedef void subaruCommandProc(void *c);
+
+struct subaruCommand {
+    char *name;
+    int arity;          /* Number of arguments including the name, -N means >= N. */
+    char *sflags;       /* Flags as string representation. */
+    int flags;          /* The actual flags, obtained from 'sflags'. */
+    sds sname;          /* 'name' as sds, created by commandTableInit(). */
+    int latency_event;  /* Latency histogram of the command, -1 if none. */
+    subaruCommandProc *proc; /* Implementation, set by commandSetProc(). */
+};
+
+void commandTableInit(void);
+struct subaruCommand *lookupCommand(sds name);
+struct subaruCommand *lookupCommandByCString(char *name);
+int commandSetProc(char *name, subaruCommandProc *proc);
+void call(struct subaruCommand *cmd, void *c);
+
+#endif /* __COMMAND_H */
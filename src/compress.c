@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "compress.h"
+#include "xlzf.h"
+#include "zmalloc.h"
+
+#define COMPRESS_HDR_SIZE 4
+
+static size_t compress_threshold = COMPRESS_DEFAULT_THRESHOLD;
+
+/* Updated with relaxed atomics, since several threads may compress and
+ * decompress values at the same time. */
+static struct {
+    unsigned long long compressed;      /* Values stored compressed. */
+    unsigned long long rejected;        /* Values that did not compress. */
+    unsigned long long in_bytes;        /* Input of the compressed values. */
+    unsigned long long out_bytes;       /* Their compressed size. */
+    unsigned long long compress_bytes;  /* All the bytes given to the codec. */
+    unsigned long long compress_ns;
+    unsigned long long decompressed;
+    unsigned long long decompress_bytes;
+    unsigned long long decompress_ns;
+} compress_stat;
+
+#define statAdd(field,n) __atomic_add_fetch(&compress_stat.field, (n), __ATOMIC_RELAXED)
+#define statGet(field) __atomic_load_n(&compress_stat.field, __ATOMIC_RELAXED)
+
+static unsigned long long nstime(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void compressSetThreshold(size_t bytes){
+    //values shorter than 'bytes' are never compressed, 0 disables compression
+    compress_threshold = bytes;
+}
+
+size_t compressGetThreshold(void){
+    return compress_threshold;
+}
+
+sds compressValue(sds val, int *encoding){
+    //compress val if long enough and if it saves at least 1/8 of its size.
+    //val is consumed: the returned sds is either val or its compressed form,
+    //trimmed so that zmalloc accounts the compressed size only.
+    size_t len = sdslen(val), maxout, clen;
+    unsigned long long start;
+    sds c;
+
+    *encoding = VALUE_ENCODING_RAW;
+    if(compress_threshold == 0 || len < compress_threshold || len > UINT32_MAX){
+        return val;
+    }
+
+    maxout = len-len/8;
+    c = sdsnewlen(NULL, COMPRESS_HDR_SIZE+maxout);
+    start = nstime();
+    clen = xlzf_compress(val, len, c+COMPRESS_HDR_SIZE, maxout);
+    statAdd(compress_ns, nstime()-start);
+    statAdd(compress_bytes, len);
+    if(clen == 0){
+        statAdd(rejected, 1);
+        sdsfree(c);
+        return val;
+    }
+
+    c[0] = len & 0xff;
+    c[1] = (len >> 8) & 0xff;
+    c[2] = (len >> 16) & 0xff;
+    c[3] = (len >> 24) & 0xff;
+    sdsIncrLen(c, -(int)(maxout-clen));
+    c = sdsRemoveFreeSpace(c);
+    statAdd(compressed, 1);
+    statAdd(in_bytes, len);
+    statAdd(out_bytes, sdslen(c));
+    sdsfree(val);
+    *encoding = VALUE_ENCODING_LZF;
+    return c;
+}
+
+size_t compressedValueLen(const sds val, int encoding){
+    //length of the original value, without decompressing it
+    const unsigned char *p = (const unsigned char *)val;
+
+    if(encoding == VALUE_ENCODING_RAW) return sdslen(val);
+    return (size_t)p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+sds decompressValue(const sds val, int encoding){
+    //return a new sds with the original value, NULL if val is corrupted
+    size_t len, dlen;
+    unsigned long long start;
+    sds d;
+
+    if(encoding == VALUE_ENCODING_RAW) return sdsdup(val);
+    if(sdslen(val) < COMPRESS_HDR_SIZE) return NULL;
+
+    len = compressedValueLen(val, encoding);
+    d = sdsnewlen(NULL, len);
+    start = nstime();
+    dlen = xlzf_decompress(val+COMPRESS_HDR_SIZE, sdslen(val)-COMPRESS_HDR_SIZE, d, len);
+    statAdd(decompress_ns, nstime()-start);
+    if(dlen != len){
+        sdsfree(d);
+        return NULL;
+    }
+    statAdd(decompressed, 1);
+    statAdd(decompress_bytes, len);
+    return d;
+}
+
+sds compressInfoString(sds info){
+    //append the compression section of INFO
+    unsigned long long in = statGet(in_bytes), out = statGet(out_bytes);
+    unsigned long long cb = statGet(compress_bytes), db = statGet(decompress_bytes);
+
+    return sdscatprintf(info,
+        "# Compression\r\n"
+        "compress_threshold:%zu\r\n"
+        "compressed_values:%llu\r\n"
+        "compress_rejected:%llu\r\n"
+        "compress_input_bytes:%llu\r\n"
+        "compress_output_bytes:%llu\r\n"
+        "compress_ratio:%.2f\r\n"
+        "compress_cpu_ms_per_gb:%.2f\r\n"
+        "decompressed_values:%llu\r\n"
+        "decompress_cpu_ms_per_gb:%.2f\r\n",
+        compress_threshold,
+        statGet(compressed),
+        statGet(rejected),
+        in, out,
+        out ? (double)in/out : 0,
+        cb ? (double)statGet(compress_ns)*1000/cb : 0,
+        statGet(decompressed),
+        db ? (double)statGet(decompress_ns)*1000/db : 0);
+}
@@ -0,0 +1,19 @@
+#ifndef __COMPRESS_H
+#define __COMPRESS_H
+
+#include "xsds.h"
+
+/* Encoding of a string value, stored by the caller next to the value. */
+#define VALUE_ENCODING_RAW 0    /* Plain sds. */
+#define VALUE_ENCODING_LZF 1    /* Original length (4 bytes) + xlzf stream. */
+
+#define COMPRESS_DEFAULT_THRESHOLD 1024
+
+void compressSetThreshold(size_t bytes);
+size_t compressGetThreshold(void);
+sds compressValue(sds val, int *encoding);
+sds decompressValue(const sds val, int encoding);
+size_t compressedValueLen(const sds val, int encoding);
+sds compressInfoString(sds info);
+
+#endif /* __COMPRESS_H */
@@ -0,0 +1,578 @@
+/* hyperloglog.c - HyperLogLog cardinality estimator stored in sds values.
+ *
+ * The encodings, the sparse opcodes, the estimator and the hash function
+ * follow the Redis implementation.
+ *
+ * Copyright (c) 2014, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "hyperloglog.h"
+#include "zmalloc.h"
+
+/* A HyperLogLog is a plain sds value made of a 16 bytes header followed by
+ * the registers, in one of two encodings:
+ *
+ * +------+---+-----+----------+
+ * | HYLL | E | N/U | Cardin.  |
+ * +------+---+-----+----------+
+ *
+ * E is HLL_DENSE or HLL_SPARSE, N/U is unused, and the last 8 bytes cache
+ * the cardinality (little endian), the most significant bit of the last byte
+ * being set when the cache is stale.
+ *
+ * Dense: HLL_REGISTERS registers of 6 bits each, from the least significant
+ * bit of each byte to the most significant one.
+ *
+ * Sparse: a run length encoding of the registers, with three opcodes:
+ *
+ * ZERO:   00xxxxxx, xxxxxx+1 (1 to 64) registers set to 0.
+ * XZERO:  01xxxxxx yyyyyyyy, xxxxxxyyyyyyyy+1 (1 to 16384) zero registers.
+ * VAL:    1vvvvvxx, xx+1 (1 to 4) registers set to vvvvv+1 (1 to 32).
+ *
+ * A sparse HLL is promoted to dense when a register exceeds 32 or when it
+ * grows beyond HLL_SPARSE_MAX_BYTES. */
+
+#define HLL_MAGIC "HYLL"
+#define HLL_HDR_SIZE 16
+#define HLL_DENSE 0
+#define HLL_SPARSE 1
+#define HLL_DENSE_SIZE (HLL_HDR_SIZE+((HLL_REGISTERS*HLL_BITS+7)/8))
+#define HLL_REGISTER_MAX ((1<<HLL_BITS)-1)
+#define HLL_SPARSE_MAX_BYTES 3000
+#define HLL_ALPHA_INF 0.721347520444481703680 /* constant for 0.5/ln(2) */
+
+#define HLL_ENCODING(s) ((unsigned char)(s)[4])
+#define HLL_CARD(s) ((uint8_t *)(s)+8)
+#define HLL_VALID_CACHE(s) ((HLL_CARD(s)[7] & (1<<7)) == 0)
+#define HLL_INVALIDATE_CACHE(s) (HLL_CARD(s)[7] |= (1<<7))
+#define HLL_REGS(s) ((uint8_t *)(s)+HLL_HDR_SIZE)
+
+#define HLL_SPARSE_XZERO_BIT 0x40
+#define HLL_SPARSE_VAL_BIT 0x80
+#define HLL_SPARSE_IS_ZERO(p) (((*(p)) & 0xc0) == 0)
+#define HLL_SPARSE_IS_XZERO(p) (((*(p)) & 0xc0) == HLL_SPARSE_XZERO_BIT)
+#define HLL_SPARSE_IS_VAL(p) ((*(p)) & HLL_SPARSE_VAL_BIT)
+#define HLL_SPARSE_ZERO_LEN(p) (((*(p)) & 0x3f)+1)
+#define HLL_SPARSE_XZERO_LEN(p) (((((*(p)) & 0x3f) << 8) | (*((p)+1)))+1)
+#define HLL_SPARSE_VAL_VALUE(p) ((((*(p)) >> 2) & 0x1f)+1)
+#define HLL_SPARSE_VAL_LEN(p) (((*(p)) & 0x3)+1)
+#define HLL_SPARSE_VAL_MAX_VALUE 32
+#define HLL_SPARSE_VAL_MAX_LEN 4
+#define HLL_SPARSE_ZERO_MAX_LEN 64
+#define HLL_SPARSE_XZERO_MAX_LEN 16384
+#define HLL_SPARSE_VAL_SET(p,val,len) (*(p) = (((val)-1)<<2|((len)-1))|HLL_SPARSE_VAL_BIT)
+#define HLL_SPARSE_ZERO_SET(p,len) (*(p) = (len)-1)
+#define HLL_SPARSE_XZERO_SET(p,len) do { \
+    int _l = (len)-1; \
+    *(p) = (_l>>8) | HLL_SPARSE_XZERO_BIT; \
+    *((p)+1) = (_l&0xff); \
+} while(0)
+
+/* Register 'regnum' spans at most two bytes. Reading the second byte of the
+ * last register is safe thanks to the sds null terminator. */
+#define HLL_DENSE_GET_REGISTER(target,p,regnum) do { \
+    uint8_t *_p = (uint8_t*) p; \
+    unsigned long _byte = (regnum)*HLL_BITS/8; \
+    unsigned long _fb = (regnum)*HLL_BITS&7; \
+    unsigned long _fb8 = 8 - _fb; \
+    unsigned long b0 = _p[_byte]; \
+    unsigned long b1 = _p[_byte+1]; \
+    target = ((b0 >> _fb) | (b1 << _fb8)) & HLL_REGISTER_MAX; \
+} while(0)
+
+#define HLL_DENSE_SET_REGISTER(p,regnum,val) do { \
+    uint8_t *_p = (uint8_t*) p; \
+    unsigned long _byte = (regnum)*HLL_BITS/8; \
+    unsigned long _fb = (regnum)*HLL_BITS&7; \
+    unsigned long _fb8 = 8 - _fb; \
+    unsigned long _v = (val); \
+    _p[_byte] &= ~(HLL_REGISTER_MAX << _fb); \
+    _p[_byte] |= _v << _fb; \
+    _p[_byte+1] &= ~(HLL_REGISTER_MAX >> _fb8); \
+    _p[_byte+1] |= _v >> _fb8; \
+} while(0)
+
+/*-----------------------------Hashing-------------------------*/
+static uint64_t MurmurHash64A(const void *key, size_t len, unsigned int seed){
+    //MurmurHash2, 64 bit version, reading the key as little endian words
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t *data = (const uint8_t *)key;
+    const uint8_t *end = data + (len-(len&7));
+
+    while(data != end){
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+    switch(len & 7){
+    case 7: h ^= (uint64_t)data[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)data[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)data[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)data[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)data[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)data[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static int hllPatLen(const void *ele, size_t len, long *regp){
+    //register index of ele, and the length of the 000..1 pattern that
+    //follows the index bits in its hash
+    uint64_t hash = MurmurHash64A(ele, len, 0xadc83b19ULL);
+
+    *regp = (long)(hash & (HLL_REGISTERS-1));
+    hash >>= HLL_P;
+    hash |= ((uint64_t)1 << HLL_Q); //make sure the loop terminates
+    return __builtin_ctzll(hash)+1;
+}
+
+/*-----------------------------Register access-------------------------*/
+static void hllDenseToRaw(uint8_t *raw, const uint8_t *regs){
+    //unpack 4 registers out of every 3 bytes
+    int j;
+
+    for(j = 0; j < HLL_REGISTERS; j += 4){
+        unsigned int b0 = regs[0], b1 = regs[1], b2 = regs[2];
+        raw[j] = b0 & 63;
+        raw[j+1] = ((b0 >> 6) | (b1 << 2)) & 63;
+        raw[j+2] = ((b1 >> 4) | (b2 << 4)) & 63;
+        raw[j+3] = b2 >> 2;
+        regs += 3;
+    }
+}
+
+static void hllRawToDense(uint8_t *regs, const uint8_t *raw){
+    int j;
+
+    for(j = 0; j < HLL_REGISTERS; j += 4){
+        regs[0] = raw[j] | (raw[j+1] << 6);
+        regs[1] = (raw[j+1] >> 2) | (raw[j+2] << 4);
+        regs[2] = (raw[j+2] >> 4) | (raw[j+3] << 2);
+        regs += 3;
+    }
+}
+
+static void hllMaxRaw(uint8_t *max, const uint8_t *raw){
+    //register-wise max, 16 registers per step with SSE2
+    int j = 0;
+
+#if defined(__SSE2__)
+    for(; j < HLL_REGISTERS; j += 16){
+        __m128i a = _mm_loadu_si128((const __m128i *)(max+j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(raw+j));
+        _mm_storeu_si128((__m128i *)(max+j), _mm_max_epu8(a, b));
+    }
+#endif
+    for(; j < HLL_REGISTERS; j++){
+        if(raw[j] > max[j]) max[j] = raw[j];
+    }
+}
+
+static int hllSparseToRaw(uint8_t *raw, const sds hll){
+    //expand a sparse HLL, returns -1 if the encoding is corrupted
+    const uint8_t *p = HLL_REGS(hll), *end = (uint8_t *)hll+sdslen(hll);
+    long idx = 0;
+
+    while(p < end){
+        long runlen;
+        if(HLL_SPARSE_IS_ZERO(p)){
+            runlen = HLL_SPARSE_ZERO_LEN(p);
+            if(idx+runlen > HLL_REGISTERS) return -1;
+            memset(raw+idx, 0, runlen);
+            p++;
+        }
+        else if(HLL_SPARSE_IS_XZERO(p)){
+            runlen = HLL_SPARSE_XZERO_LEN(p);
+            if(idx+runlen > HLL_REGISTERS) return -1;
+            memset(raw+idx, 0, runlen);
+            p += 2;
+        }
+        else{
+            runlen = HLL_SPARSE_VAL_LEN(p);
+            if(idx+runlen > HLL_REGISTERS) return -1;
+            memset(raw+idx, HLL_SPARSE_VAL_VALUE(p), runlen);
+            p++;
+        }
+        idx += runlen;
+    }
+    return idx == HLL_REGISTERS ? 0 : -1;
+}
+
+static int hllToRaw(uint8_t *raw, const sds hll){
+    if(HLL_ENCODING(hll) == HLL_DENSE){
+        hllDenseToRaw(raw, HLL_REGS(hll));
+        return 0;
+    }
+    return hllSparseToRaw(raw, hll);
+}
+
+static sds hllCreateDense(const uint8_t *raw){
+    //dense HLL with the given registers, the cache starts stale
+    sds s = sdsnewlen(NULL, HLL_DENSE_SIZE);
+
+    memcpy(s, HLL_MAGIC, 4);
+    s[4] = HLL_DENSE;
+    HLL_INVALIDATE_CACHE(s);
+    hllRawToDense(HLL_REGS(s), raw);
+    return s;
+}
+
+static int hllSparseToDense(sds *hllp){
+    //promote *hllp to the dense encoding, returns -1 on corrupted input
+    uint8_t *raw = zmalloc(HLL_REGISTERS);
+    sds dense;
+
+    if(hllSparseToRaw(raw, *hllp) == -1){
+        zfree(raw);
+        return -1;
+    }
+    dense = hllCreateDense(raw);
+    zfree(raw);
+    sdsfree(*hllp);
+    *hllp = dense;
+    return 0;
+}
+
+static int hllDenseSet(uint8_t *regs, long index, uint8_t count){
+    uint8_t oldcount;
+
+    HLL_DENSE_GET_REGISTER(oldcount, regs, index);
+    if(count <= oldcount) return 0;
+    HLL_DENSE_SET_REGISTER(regs, index, count);
+    return 1;
+}
+
+static int hllSparseSet(sds *hllp, long index, uint8_t count){
+    //set register index to count if greater, splitting the opcode that
+    //covers it. Returns 1 if the register changed, 0 if not, -1 on error.
+    uint8_t *start, *p, *end, *prev = NULL, seq[5], *n = seq;
+    long first = 0, span = 0, last;
+    int is_zero = 0, is_xzero = 0, is_val = 0, runlen = 0, oldlen, seqlen, deltalen;
+    uint8_t oldcount = 0;
+    sds s;
+
+    if(count > HLL_SPARSE_VAL_MAX_VALUE) goto promote;
+
+    //splitting an opcode grows the string by 3 bytes at most
+    s = sdsMakeRoomFor(*hllp, 3);
+    if(s == NULL) return -1;
+    *hllp = s;
+    start = HLL_REGS(s);
+    end = (uint8_t *)s+sdslen(s);
+
+    //find the opcode covering the register
+    p = start;
+    while(p < end){
+        oldlen = 1;
+        if(HLL_SPARSE_IS_ZERO(p)) span = HLL_SPARSE_ZERO_LEN(p);
+        else if(HLL_SPARSE_IS_VAL(p)) span = HLL_SPARSE_VAL_LEN(p);
+        else{
+            span = HLL_SPARSE_XZERO_LEN(p);
+            oldlen = 2;
+        }
+        if(index <= first+span-1) break;
+        prev = p;
+        p += oldlen;
+        first += span;
+    }
+    if(p >= end || span == 0) return -1;
+    last = first+span-1;
+
+    if(HLL_SPARSE_IS_ZERO(p)){
+        is_zero = 1;
+        runlen = HLL_SPARSE_ZERO_LEN(p);
+    }
+    else if(HLL_SPARSE_IS_XZERO(p)){
+        is_xzero = 1;
+        runlen = HLL_SPARSE_XZERO_LEN(p);
+    }
+    else{
+        is_val = 1;
+        runlen = HLL_SPARSE_VAL_LEN(p);
+        oldcount = HLL_SPARSE_VAL_VALUE(p);
+    }
+
+    //fast paths: the opcode is replaced by a single VAL of the same size
+    if(is_val && oldcount >= count) return 0;
+    if((is_val || is_zero) && runlen == 1){
+        HLL_SPARSE_VAL_SET(p, count, 1);
+        goto updated;
+    }
+
+    //general case: up to three opcodes replace the old one
+    if(is_zero || is_xzero){
+        if(index != first){
+            long len = index-first;
+            if(len > HLL_SPARSE_ZERO_MAX_LEN){
+                HLL_SPARSE_XZERO_SET(n, len);
+                n += 2;
+            }
+            else{
+                HLL_SPARSE_ZERO_SET(n, len);
+                n++;
+            }
+        }
+        HLL_SPARSE_VAL_SET(n, count, 1);
+        n++;
+        if(index != last){
+            long len = last-index;
+            if(len > HLL_SPARSE_ZERO_MAX_LEN){
+                HLL_SPARSE_XZERO_SET(n, len);
+                n += 2;
+            }
+            else{
+                HLL_SPARSE_ZERO_SET(n, len);
+                n++;
+            }
+        }
+    }
+    else{
+        if(index != first){
+            HLL_SPARSE_VAL_SET(n, oldcount, index-first);
+            n++;
+        }
+        HLL_SPARSE_VAL_SET(n, count, 1);
+        n++;
+        if(index != last){
+            HLL_SPARSE_VAL_SET(n, oldcount, last-index);
+            n++;
+        }
+    }
+
+    seqlen = n-seq;
+    oldlen = is_xzero ? 2 : 1;
+    deltalen = seqlen-oldlen;
+    if(deltalen > 0 && sdslen(s)-HLL_HDR_SIZE+deltalen > HLL_SPARSE_MAX_BYTES){
+        goto promote;
+    }
+    if(deltalen && end-p-oldlen > 0){
+        memmove(p+seqlen, p+oldlen, end-p-oldlen);
+    }
+    memcpy(p, seq, seqlen);
+    sdsIncrLen(s, deltalen);
+    end += deltalen;
+
+updated:
+    //merge adjacent VAL opcodes with the same value around the change
+    p = prev ? prev : start;
+    runlen = 5;
+    while(p < end && runlen--){
+        if(HLL_SPARSE_IS_XZERO(p)){
+            p += 2;
+            continue;
+        }
+        if(HLL_SPARSE_IS_VAL(p) && p+1 < end && HLL_SPARSE_IS_VAL(p+1)){
+            int v1 = HLL_SPARSE_VAL_VALUE(p), v2 = HLL_SPARSE_VAL_VALUE(p+1);
+            int len = HLL_SPARSE_VAL_LEN(p)+HLL_SPARSE_VAL_LEN(p+1);
+            if(v1 == v2 && len <= HLL_SPARSE_VAL_MAX_LEN){
+                HLL_SPARSE_VAL_SET(p, v1, len);
+                memmove(p+1, p+2, end-p-2);
+                sdsIncrLen(s, -1);
+                end--;
+                continue;
+            }
+        }
+        p++;
+    }
+    HLL_INVALIDATE_CACHE(s);
+    return 1;
+
+promote:
+    if(hllSparseToDense(hllp) == -1) return -1;
+    return hllDenseSet(HLL_REGS(*hllp), index, count);
+}
+
+/*-----------------------------Estimation-------------------------*/
+static double hllSigma(double x){
+    if(x == 1.) return INFINITY;
+    double zPrime, y = 1, z = x;
+    do{
+        x *= x;
+        zPrime = z;
+        z += x*y;
+        y += y;
+    }while(zPrime != z);
+    return z;
+}
+
+static double hllTau(double x){
+    if(x == 0. || x == 1.) return 0.;
+    double zPrime, y = 1.0, z = 1-x;
+    do{
+        x = sqrt(x);
+        zPrime = z;
+        y *= 0.5;
+        z -= pow(1-x, 2)*y;
+    }while(zPrime != z);
+    return z/3;
+}
+
+static uint64_t hllEstimate(const uint8_t *raw){
+    //Otmar Ertl's improved estimator, from the register histogram
+    int reghisto[64] = {0}, j;
+    double m = HLL_REGISTERS, z;
+
+    for(j = 0; j < HLL_REGISTERS; j++){
+        reghisto[raw[j]]++;
+    }
+    z = m * hllTau((m-reghisto[HLL_Q+1])/m);
+    for(j = HLL_Q; j >= 1; --j){
+        z += reghisto[j];
+        z *= 0.5;
+    }
+    z += m * hllSigma(reghisto[0]/m);
+    return (uint64_t)llroundl(HLL_ALPHA_INF*m*m/z);
+}
+
+/*-----------------------------APIs-------------------------*/
+sds hllCreate(void){
+    //empty sparse HLL: a single XZERO covering all the registers
+    sds s = sdsnewlen(NULL, HLL_HDR_SIZE+2);
+
+    memcpy(s, HLL_MAGIC, 4);
+    s[4] = HLL_SPARSE;
+    HLL_SPARSE_XZERO_SET(HLL_REGS(s), HLL_REGISTERS);
+    return s;
+}
+
+int hllIsValid(const sds hll){
+    size_t len = sdslen(hll);
+
+    if(len < HLL_HDR_SIZE || memcmp(hll, HLL_MAGIC, 4) != 0) return 0;
+    if(HLL_ENCODING(hll) == HLL_DENSE) return len == HLL_DENSE_SIZE;
+    return HLL_ENCODING(hll) == HLL_SPARSE;
+}
+
+int hllAdd(sds *hll, const void *ele, size_t len){
+    //PFADD: returns 1 if a register changed, 0 if not, -1 if *hll is invalid
+    long index;
+    uint8_t count = hllPatLen(ele, len, &index);
+
+    if(!hllIsValid(*hll)) return -1;
+    if(HLL_ENCODING(*hll) == HLL_SPARSE){
+        return hllSparseSet(hll, index, count);
+    }
+    if(hllDenseSet(HLL_REGS(*hll), index, count)){
+        HLL_INVALIDATE_CACHE(*hll);
+        return 1;
+    }
+    return 0;
+}
+
+uint64_t hllCount(sds hll, int *invalid){
+    //PFCOUNT of a single key, served from the cache when it is fresh
+    uint8_t *card = HLL_CARD(hll), *raw;
+    uint64_t c;
+    int j;
+
+    if(invalid) *invalid = 0;
+    if(!hllIsValid(hll)){
+        if(invalid) *invalid = 1;
+        return 0;
+    }
+    if(HLL_VALID_CACHE(hll)){
+        for(c = 0, j = 7; j >= 0; j--) c = (c << 8) | card[j];
+        return c;
+    }
+
+    raw = zmalloc(HLL_REGISTERS);
+    if(hllToRaw(raw, hll) == -1){
+        zfree(raw);
+        if(invalid) *invalid = 1;
+        return 0;
+    }
+    c = hllEstimate(raw);
+    zfree(raw);
+    for(j = 0; j < 8; j++) card[j] = (c >> (j*8)) & 0xff;
+    return c;
+}
+
+int hllMerge(uint8_t *max, const sds hll){
+    //max[i] = MAX(max[i], register i of hll), returns -1 if hll is invalid
+    uint8_t *raw;
+    int retval;
+
+    if(!hllIsValid(hll)) return -1;
+    raw = zmalloc(HLL_REGISTERS);
+    retval = hllToRaw(raw, hll);
+    if(retval == 0) hllMaxRaw(max, raw);
+    zfree(raw);
+    return retval;
+}
+
+uint64_t hllCountUnion(sds *hlls, int numkeys, int *invalid){
+    //PFCOUNT of several keys: cardinality of their union
+    uint8_t *max = zcalloc(HLL_REGISTERS);
+    uint64_t c = 0;
+    int j;
+
+    *invalid = 0;
+    for(j = 0; j < numkeys; j++){
+        if(hllMerge(max, hlls[j]) == -1){
+            *invalid = 1;
+            break;
+        }
+    }
+    if(!*invalid) c = hllEstimate(max);
+    zfree(max);
+    return c;
+}
+
+sds hllMergeMany(sds *hlls, int numkeys){
+    //PFMERGE: a new dense HLL holding the union, NULL if an input is invalid
+    uint8_t *max = zcalloc(HLL_REGISTERS);
+    sds s = NULL;
+    int j;
+
+    for(j = 0; j < numkeys; j++){
+        if(hllMerge(max, hlls[j]) == -1) goto cleanup;
+    }
+    s = hllCreateDense(max);
+
+cleanup:
+    zfree(max);
+    return s;
+}
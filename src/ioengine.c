@@ -0,0 +1,690 @@
+#define _GNU_SOURCE /* accept4() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "ioengine.h"
+#include "zmalloc.h"
+
+/* The io_uring backend needs the 5.11 UAPI: IORING_ENTER_EXT_ARG for
+ * timed waits and IORING_OP_ASYNC_CANCEL. The opcode is an enum the
+ * preprocessor cannot see, the 5.11 feature macros imply it. With older
+ * kernel headers only epoll is built. */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_ENTER_EXT_ARG)
+#define HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#define IO_URING_ENTRIES 4096
+
+typedef struct ioRequest {
+    int op;
+    int fd;
+    int multishot;          /* IO_OP_ACCEPT: armed as multishot accept. */
+    int cancelled;          /* Detached from its fd by ioEngineRemove(). */
+    sds *querybuf;          /* IO_OP_RECV: buffer receiving the data. */
+    const void *buf;        /* IO_OP_WRITE: data to write. */
+    size_t len;
+    off_t offset;
+    void *udata;
+    struct ioRequest *prev; /* Pending writes of the fd, oldest first. */
+    struct ioRequest *next;
+} ioRequest;
+
+/* Requests pending on a descriptor: at most one accept and one recv, and
+ * any number of writes, so that ioEngineRemove() can cancel all of them. */
+typedef struct ioFdState {
+    ioRequest *accept;
+    ioRequest *recv;
+    ioRequest *whead;
+    ioRequest *wtail;
+    int mask;               /* Events registered in epoll. */
+    int registered;
+} ioFdState;
+
+#ifdef HAVE_IO_URING
+typedef struct ioUring {
+    int fd;
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;     /* Queued entries not yet seen by the kernel. */
+} ioUring;
+#endif
+
+struct ioEngine {
+    int type;
+    int setsize;
+    unsigned long long syscalls;
+    ioFdState *fds;
+    ioCompletion *ready;    /* Completions not reported yet. */
+    int nready;
+    int readycap;
+    /* epoll backend */
+    int epfd;
+    struct epoll_event *events;
+#ifdef HAVE_IO_URING
+    ioUring uring;
+#endif
+};
+
+/*-----------------------------Requests-------------------------*/
+static ioRequest *ioRequestCreate(int op, int fd, void *udata){
+    ioRequest *req = zcalloc(sizeof(*req));
+
+    req->op = op;
+    req->fd = fd;
+    req->udata = udata;
+    return req;
+}
+
+static void ioWriteLink(ioFdState *st, ioRequest *req){
+    req->prev = st->wtail;
+    req->next = NULL;
+    if(st->wtail) st->wtail->next = req;
+    else st->whead = req;
+    st->wtail = req;
+}
+
+static void ioWriteUnlink(ioFdState *st, ioRequest *req){
+    if(req->prev) req->prev->next = req->next;
+    else st->whead = req->next;
+    if(req->next) req->next->prev = req->prev;
+    else st->wtail = req->prev;
+    req->prev = req->next = NULL;
+}
+
+static void ioRequestDetach(ioEngine *e, ioRequest *req){
+    //forget a request that completed for good
+    ioFdState *st = &e->fds[req->fd];
+
+    if(req->cancelled) return;
+    if(req->op == IO_OP_ACCEPT) st->accept = NULL;
+    else if(req->op == IO_OP_RECV) st->recv = NULL;
+    else ioWriteUnlink(st, req);
+}
+
+static void ioPost(ioEngine *e, int op, int fd, int res, void *udata){
+    //queue a completion, reported by the next ioEngineWait()
+    if(e->nready == e->readycap){
+        e->readycap = e->readycap ? e->readycap*2 : 64;
+        e->ready = zrealloc(e->ready, sizeof(ioCompletion)*e->readycap);
+    }
+    e->ready[e->nready].op = op;
+    e->ready[e->nready].fd = fd;
+    e->ready[e->nready].res = res;
+    e->ready[e->nready].udata = udata;
+    e->nready++;
+}
+
+static int ioTakeReady(ioEngine *e, ioCompletion *events, int maxevents){
+    int n = e->nready < maxevents ? e->nready : maxevents;
+
+    if(n == 0) return 0;
+    memcpy(events, e->ready, sizeof(ioCompletion)*n);
+    memmove(e->ready, e->ready+n, sizeof(ioCompletion)*(e->nready-n));
+    e->nready -= n;
+    return n;
+}
+
+/*-----------------------------epoll backend-------------------------*/
+static int ioEpollCreate(ioEngine *e){
+    e->epfd = epoll_create(1024);
+    if(e->epfd == -1) return -1;
+    e->events = zmalloc(sizeof(struct epoll_event)*e->setsize);
+    return 0;
+}
+
+static void ioEpollUpdate(ioEngine *e, int fd){
+    //wait for reading while an accept or a recv is pending, for writing
+    //while writes are queued. With nothing pending the descriptor leaves
+    //the epoll set: an empty interest mask still reports EPOLLERR and
+    //EPOLLHUP, and a reset peer would wake every epoll_wait().
+    ioFdState *st = &e->fds[fd];
+    struct epoll_event ee;
+    int mask = ((st->accept || st->recv) ? EPOLLIN : 0) | (st->whead ? EPOLLOUT : 0);
+
+    if(mask == 0){
+        if(st->registered){
+            epoll_ctl(e->epfd, EPOLL_CTL_DEL, fd, NULL);
+            e->syscalls++;
+            st->registered = 0;
+        }
+        st->mask = 0;
+        return;
+    }
+    if(mask == st->mask && st->registered) return;
+    memset(&ee, 0, sizeof(ee));
+    ee.events = mask;
+    ee.data.fd = fd;
+    epoll_ctl(e->epfd, st->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ee);
+    e->syscalls++;
+    st->registered = 1;
+    st->mask = mask;
+}
+
+static ssize_t ioEpollWriteNow(ioEngine *e, ioRequest *req){
+    ssize_t n;
+
+    if(req->offset >= 0) n = pwrite(req->fd, req->buf, req->len, req->offset);
+    else n = write(req->fd, req->buf, req->len);
+    e->syscalls++;
+    return n;
+}
+
+static int ioEpollWrite(ioEngine *e, ioRequest *req){
+    //write right away unless the socket is full: the write is then queued
+    //until the descriptor is writable, behind the ones already queued
+    ioFdState *st = &e->fds[req->fd];
+    ssize_t n;
+
+    if(st->whead == NULL){
+        n = ioEpollWriteNow(e, req);
+        if(n != -1 || (errno != EAGAIN && errno != EINTR)){
+            ioPost(e, IO_OP_WRITE, req->fd, n == -1 ? -errno : (int)n, req->udata);
+            zfree(req);
+            return 0;
+        }
+    }
+    ioWriteLink(st, req);
+    ioEpollUpdate(e, req->fd);
+    return 0;
+}
+
+static void ioEpollReadable(ioEngine *e, int fd){
+    ioFdState *st = &e->fds[fd];
+
+    while(st->accept){
+        int cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+
+        e->syscalls++;
+        if(cfd == -1 && (errno == EAGAIN || errno == EINTR)) break;
+        ioPost(e, IO_OP_ACCEPT, fd, cfd == -1 ? -errno : cfd, st->accept->udata);
+        if(cfd == -1) break;
+    }
+    if(st->recv){
+        ioRequest *req = st->recv;
+        ssize_t nread = read(fd, *req->querybuf+sdslen(*req->querybuf), req->len);
+
+        e->syscalls++;
+        if(nread == -1 && (errno == EAGAIN || errno == EINTR)) return;
+        if(nread > 0) sdsIncrLen(*req->querybuf, nread);
+        ioPost(e, IO_OP_RECV, fd, nread == -1 ? -errno : (int)nread, req->udata);
+        st->recv = NULL;
+        zfree(req);
+    }
+}
+
+static void ioEpollWritable(ioEngine *e, int fd){
+    ioFdState *st = &e->fds[fd];
+
+    while(st->whead){
+        ioRequest *req = st->whead;
+        ssize_t n = ioEpollWriteNow(e, req);
+
+        if(n == -1 && (errno == EAGAIN || errno == EINTR)) break;
+        ioPost(e, IO_OP_WRITE, fd, n == -1 ? -errno : (int)n, req->udata);
+        ioWriteUnlink(st, req);
+        zfree(req);
+    }
+}
+
+static int ioEpollWait(ioEngine *e, ioCompletion *events, int maxevents, int timeout_ms){
+    int numevents, j;
+
+    numevents = epoll_wait(e->epfd, e->events, e->setsize, e->nready ? 0 : timeout_ms);
+    e->syscalls++;
+    for(j = 0; j < numevents; j++){
+        int fd = e->events[j].data.fd, mask = e->events[j].events;
+
+        if(mask & (EPOLLIN|EPOLLERR|EPOLLHUP)) ioEpollReadable(e, fd);
+        if(mask & (EPOLLOUT|EPOLLERR|EPOLLHUP)) ioEpollWritable(e, fd);
+        ioEpollUpdate(e, fd);
+    }
+    return ioTakeReady(e, events, maxevents);
+}
+
+static void ioEpollRemove(ioEngine *e, int fd){
+    //pending operations complete with -ECANCELED, as with io_uring
+    ioFdState *st = &e->fds[fd];
+
+    if(st->registered){
+        epoll_ctl(e->epfd, EPOLL_CTL_DEL, fd, NULL);
+        e->syscalls++;
+    }
+    if(st->accept){
+        ioPost(e, IO_OP_ACCEPT, fd, -ECANCELED, st->accept->udata);
+        zfree(st->accept);
+    }
+    if(st->recv){
+        ioPost(e, IO_OP_RECV, fd, -ECANCELED, st->recv->udata);
+        zfree(st->recv);
+    }
+    while(st->whead){
+        ioRequest *req = st->whead;
+
+        ioPost(e, IO_OP_WRITE, fd, -ECANCELED, req->udata);
+        ioWriteUnlink(st, req);
+        zfree(req);
+    }
+    memset(st, 0, sizeof(*st));
+}
+
+/*-----------------------------io_uring backend-------------------------*/
+#ifdef HAVE_IO_URING
+static int ioUringSetup(ioEngine *e, unsigned entries){
+    //map the rings with the raw system calls, so that no library is needed.
+    //Kernels without single mmap rings or timeouts in io_uring_enter()
+    //(before 5.11) are refused, and the caller falls back to epoll.
+    ioUring *u = &e->uring;
+    struct io_uring_params p;
+    size_t sqsize, cqsize;
+    char *ring;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(u->fd < 0) return -1;
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)){
+        close(u->fd);
+        return -1;
+    }
+
+    sqsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    cqsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    u->ring_size = sqsize > cqsize ? sqsize : cqsize;
+    u->ring = mmap(NULL, u->ring_size, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->ring == MAP_FAILED){
+        close(u->fd);
+        return -1;
+    }
+    u->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED){
+        munmap(u->ring, u->ring_size);
+        close(u->fd);
+        return -1;
+    }
+
+    ring = u->ring;
+    u->sq_head = (unsigned *)(ring+p.sq_off.head);
+    u->sq_tail = (unsigned *)(ring+p.sq_off.tail);
+    u->sq_mask = (unsigned *)(ring+p.sq_off.ring_mask);
+    u->sq_entries = (unsigned *)(ring+p.sq_off.ring_entries);
+    u->sq_array = (unsigned *)(ring+p.sq_off.array);
+    u->cq_head = (unsigned *)(ring+p.cq_off.head);
+    u->cq_tail = (unsigned *)(ring+p.cq_off.tail);
+    u->cq_mask = (unsigned *)(ring+p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(ring+p.cq_off.cqes);
+    u->to_submit = 0;
+    return 0;
+}
+
+static void ioUringRelease(ioEngine *e){
+    ioUring *u = &e->uring;
+
+    munmap(u->sqes, u->sqes_size);
+    munmap(u->ring, u->ring_size);
+    close(u->fd);
+}
+
+static int ioUringEnter(ioEngine *e, unsigned min_complete, int timeout_ms){
+    //submit the queued entries, and wait for min_complete completions at
+    //most timeout_ms milliseconds (forever if negative)
+    ioUring *u = &e->uring;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+    int ret;
+
+    if(min_complete){
+        flags |= IORING_ENTER_GETEVENTS;
+        if(timeout_ms >= 0){
+            ts.tv_sec = timeout_ms/1000;
+            ts.tv_nsec = (timeout_ms%1000)*1000000LL;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    ret = syscall(__NR_io_uring_enter, u->fd, u->to_submit, min_complete, flags, argp, argsz);
+    e->syscalls++;
+    if(ret >= 0){
+        u->to_submit -= ret;
+        return 0;
+    }
+    return (errno == ETIME || errno == EINTR) ? 0 : -1;
+}
+
+static struct io_uring_sqe *ioUringGetSqe(ioEngine *e){
+    //next free submission entry, flushing the queue to the kernel if full
+    ioUring *u = &e->uring;
+    unsigned tail = *u->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if(tail-__atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= *u->sq_entries){
+        ioUringEnter(e, 0, 0);
+        if(tail-__atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= *u->sq_entries) return NULL;
+    }
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+static void ioUringCommitSqe(ioEngine *e){
+    //publish the entry filled after ioUringGetSqe(), submitted in batch
+    //by the next ioEngineWait()
+    ioUring *u = &e->uring;
+
+    __atomic_store_n(u->sq_tail, *u->sq_tail+1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+static int ioUringQueue(ioEngine *e, ioRequest *req){
+    struct io_uring_sqe *sqe = ioUringGetSqe(e);
+
+    if(sqe == NULL){
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->fd = req->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    switch(req->op){
+    case IO_OP_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+#ifdef IORING_ACCEPT_MULTISHOT
+        if(req->multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+#endif
+        break;
+    case IO_OP_RECV:
+        //the kernel copies straight into the room reserved in the sds
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = (uint64_t)(uintptr_t)(*req->querybuf+sdslen(*req->querybuf));
+        sqe->len = req->len;
+        break;
+    case IO_OP_WRITE:
+        //offset -1 writes at the current position, sockets included
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = req->len;
+        sqe->off = req->offset >= 0 ? (uint64_t)req->offset : (uint64_t)-1;
+        break;
+    }
+    ioUringCommitSqe(e);
+    return 0;
+}
+
+static void ioUringCancel(ioEngine *e, ioRequest *req){
+    //cancel by user_data, available since 5.5: the request completes with
+    //-ECANCELED, or with its result if it was already done. The cancel
+    //request itself has user_data 0 and is not reported.
+    struct io_uring_sqe *sqe = ioUringGetSqe(e);
+
+    req->cancelled = 1;
+    if(sqe == NULL) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)req;
+    sqe->user_data = 0;
+    ioUringCommitSqe(e);
+}
+
+static void ioUringReap(ioEngine *e){
+    ioUring *u = &e->uring;
+    unsigned head = *u->cq_head, tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    while(head != tail){
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        ioRequest *req = (ioRequest *)(uintptr_t)cqe->user_data;
+        int res = cqe->res, more = cqe->flags & IORING_CQE_F_MORE;
+
+        head++;
+        if(req == NULL) continue; //completion of a cancel request
+        if(req->op == IO_OP_ACCEPT && !more && !req->cancelled){
+            //kernel without multishot accept (before 5.19): re-arm after
+            //every connection instead
+            if(res == -EINVAL && req->multishot){
+                req->multishot = 0;
+                if(ioUringQueue(e, req) == 0) continue;
+            }
+            else if(res >= 0 || res == -EINTR || res == -EAGAIN || res == -ECONNABORTED){
+                if(ioUringQueue(e, req) == 0) more = 1;
+            }
+        }
+        else if(req->op == IO_OP_RECV && res > 0){
+            sdsIncrLen(*req->querybuf, res);
+        }
+        ioPost(e, req->op, req->fd, res, req->udata);
+        if(!more){
+            ioRequestDetach(e, req);
+            zfree(req);
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int ioUringWait(ioEngine *e, ioCompletion *events, int maxevents, int timeout_ms){
+    //one io_uring_enter() both submits the whole batch queued since the
+    //last call and waits for completions
+    ioUringReap(e);
+    if(e->nready == 0 && timeout_ms != 0){
+        if(ioUringEnter(e, 1, timeout_ms) == -1) return -1;
+        ioUringReap(e);
+    }
+    else if(e->uring.to_submit){
+        ioUringEnter(e, 0, 0);
+    }
+    return ioTakeReady(e, events, maxevents);
+}
+
+static void ioUringRemove(ioEngine *e, int fd){
+    //the requests are detached from fd right away, so the descriptor can
+    //be closed and reused, and complete later with -ECANCELED
+    ioFdState *st = &e->fds[fd];
+
+    if(st->accept) ioUringCancel(e, st->accept);
+    if(st->recv) ioUringCancel(e, st->recv);
+    while(st->whead){
+        ioRequest *req = st->whead;
+
+        ioWriteUnlink(st, req);
+        ioUringCancel(e, req);
+    }
+    memset(st, 0, sizeof(*st));
+}
+#endif
+
+/*-----------------------------API-------------------------*/
+ioEngine *ioEngineCreate(int type, int setsize){
+    ioEngine *e = zcalloc(sizeof(*e));
+
+    e->setsize = setsize;
+    e->epfd = -1;
+    e->fds = zcalloc(sizeof(ioFdState)*setsize);
+#ifdef HAVE_IO_URING
+    if(type != IO_ENGINE_EPOLL && ioUringSetup(e, IO_URING_ENTRIES) == 0){
+        e->type = IO_ENGINE_URING;
+        return e;
+    }
+#endif
+    if(type == IO_ENGINE_URING || ioEpollCreate(e) == -1){
+        zfree(e->fds);
+        zfree(e);
+        return NULL;
+    }
+    e->type = IO_ENGINE_EPOLL;
+    return e;
+}
+
+void ioEngineRelease(ioEngine *e){
+    int j;
+
+    if(e == NULL) return;
+#ifdef HAVE_IO_URING
+    //requests still in the kernel die with the ring, only the ones still
+    //attached to a descriptor are freed
+    if(e->type == IO_ENGINE_URING) ioUringRelease(e);
+#endif
+    for(j = 0; j < e->setsize; j++){
+        ioFdState *st = &e->fds[j];
+
+        zfree(st->accept);
+        zfree(st->recv);
+        while(st->whead){
+            ioRequest *req = st->whead;
+            ioWriteUnlink(st, req);
+            zfree(req);
+        }
+    }
+    if(e->epfd != -1) close(e->epfd);
+    zfree(e->fds);
+    zfree(e->events);
+    zfree(e->ready);
+    zfree(e);
+}
+
+int ioEngineType(const ioEngine *e){
+    return e->type;
+}
+
+const char *ioEngineName(const ioEngine *e){
+    return e->type == IO_ENGINE_URING ? "io_uring" : "epoll";
+}
+
+static int ioEngineCheckFd(ioEngine *e, int fd){
+    if(fd < 0 || fd >= e->setsize){
+        errno = ERANGE;
+        return -1;
+    }
+    return 0;
+}
+
+int ioEngineAccept(ioEngine *e, int listenfd, void *udata){
+    //the listening socket is made non blocking: epoll drains it with
+    //accept4() until EAGAIN
+    ioFdState *st;
+    ioRequest *req;
+    int flags;
+
+    if(ioEngineCheckFd(e, listenfd) == -1) return -1;
+    st = &e->fds[listenfd];
+    if(st->accept){
+        errno = EBUSY;
+        return -1;
+    }
+    flags = fcntl(listenfd, F_GETFL);
+    e->syscalls++;
+    if(flags == -1) return -1;
+    if(!(flags & O_NONBLOCK)){
+        e->syscalls++;
+        if(fcntl(listenfd, F_SETFL, flags|O_NONBLOCK) == -1) return -1;
+    }
+    req = ioRequestCreate(IO_OP_ACCEPT, listenfd, udata);
+#ifdef HAVE_IO_URING
+    if(e->type == IO_ENGINE_URING){
+        req->multishot = 1;
+        if(ioUringQueue(e, req) == -1){
+            zfree(req);
+            return -1;
+        }
+        st->accept = req;
+        return 0;
+    }
+#endif
+    st->accept = req;
+    ioEpollUpdate(e, listenfd);
+    return 0;
+}
+
+int ioEngineRecv(ioEngine *e, int fd, sds *querybuf, size_t readlen, void *udata){
+    ioRequest *req;
+
+    if(ioEngineCheckFd(e, fd) == -1) return -1;
+    if(e->fds[fd].recv){
+        errno = EBUSY;
+        return -1;
+    }
+    //reserve the room now: the buffer must not move while the kernel
+    //may write into it
+    *querybuf = sdsMakeRoomFor(*querybuf, readlen);
+    req = ioRequestCreate(IO_OP_RECV, fd, udata);
+    req->querybuf = querybuf;
+    req->len = readlen;
+#ifdef HAVE_IO_URING
+    if(e->type == IO_ENGINE_URING){
+        if(ioUringQueue(e, req) == -1){
+            zfree(req);
+            return -1;
+        }
+        e->fds[fd].recv = req;
+        return 0;
+    }
+#endif
+    e->fds[fd].recv = req;
+    ioEpollUpdate(e, fd);
+    return 0;
+}
+
+int ioEngineWrite(ioEngine *e, int fd, const void *buf, size_t len, off_t offset, void *udata){
+    ioRequest *req;
+
+    if(ioEngineCheckFd(e, fd) == -1) return -1;
+    req = ioRequestCreate(IO_OP_WRITE, fd, udata);
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+#ifdef HAVE_IO_URING
+    if(e->type == IO_ENGINE_URING){
+        if(ioUringQueue(e, req) == -1){
+            zfree(req);
+            return -1;
+        }
+        ioWriteLink(&e->fds[fd], req);
+        return 0;
+    }
+#endif
+    return ioEpollWrite(e, req);
+}
+
+void ioEngineRemove(ioEngine *e, int fd){
+    if(fd < 0 || fd >= e->setsize) return;
+#ifdef HAVE_IO_URING
+    if(e->type == IO_ENGINE_URING){
+        ioUringRemove(e, fd);
+        return;
+    }
+#endif
+    ioEpollRemove(e, fd);
+}
+
+int ioEngineWait(ioEngine *e, ioCompletion *events, int maxevents, int timeout_ms){
+#ifdef HAVE_IO_URING
+    if(e->type == IO_ENGINE_URING) return ioUringWait(e, events, maxevents, timeout_ms);
+#endif
+    return ioEpollWait(e, events, maxevents, timeout_ms);
+}
+
+unsigned long long ioEngineSyscalls(const ioEngine *e){
+    return e->syscalls;
+}
@@ -0,0 +1,51 @@
+#ifndef __IOENGINE_H
+#define __IOENGINE_H
+
+#include <sys/types.h>
+#include "xsds.h"
+
+/* Completion based I/O for the event loop. Operations are queued, and a
+ * call to ioEngineWait() submits them all and reports the completed ones.
+ * Two backends implement it: io_uring, that batches the submissions of a
+ * loop iteration in a single system call and receives straight into the
+ * query buffers, and epoll, that performs the same operations when their
+ * descriptor is ready. IO_ENGINE_AUTO picks io_uring when the kernel
+ * supports it, epoll otherwise.
+ *
+ * Both backends follow the same contract: every queued operation reports
+ * exactly one completion (an accept one per connection until it ends);
+ * writes to a full socket wait until it is writable; ioEngineRemove()
+ * makes the pending operations of a descriptor complete with -ECANCELED
+ * (or their result if they already finished), after which the descriptor
+ * may be closed and reused. Descriptors must be below 'setsize'. The
+ * buffers and 'udata' of a pending operation must stay valid until its
+ * completion is reported. */
+#define IO_ENGINE_AUTO 0
+#define IO_ENGINE_EPOLL 1
+#define IO_ENGINE_URING 2
+
+#define IO_OP_ACCEPT 1  /* Persistent: one completion per new connection. */
+#define IO_OP_RECV 2    /* Read into a query buffer, committed on completion. */
+#define IO_OP_WRITE 3   /* Socket write, or file write at an offset. */
+
+typedef struct ioCompletion {
+    int op;
+    int fd;
+    int res;            /* Accepted fd or bytes transferred, -errno on error. */
+    void *udata;
+} ioCompletion;
+
+typedef struct ioEngine ioEngine;
+
+ioEngine *ioEngineCreate(int type, int setsize);
+void ioEngineRelease(ioEngine *e);
+int ioEngineType(const ioEngine *e);
+const char *ioEngineName(const ioEngine *e);
+int ioEngineAccept(ioEngine *e, int listenfd, void *udata);
+int ioEngineRecv(ioEngine *e, int fd, sds *querybuf, size_t readlen, void *udata);
+int ioEngineWrite(ioEngine *e, int fd, const void *buf, size_t len, off_t offset, void *udata);
+void ioEngineRemove(ioEngine *e, int fd);
+int ioEngineWait(ioEngine *e, ioCompletion *events, int maxevents, int timeout_ms);
+unsigned long long ioEngineSyscalls(const ioEngine *e);
+
+#endif /* __IOENGINE_H */
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "latency.h"
+#include "zmalloc.h"
+#if defined(LATENCY_TSC)
+#include <cpuid.h>
+#endif
+
+/*-----------------------------Histograms-------------------------*/
+static inline int latencyBucket(uint64_t value){
+    int msb, shift;
+
+    if(value < LATENCY_SUB_BUCKETS) return (int)value;
+    msb = 63-__builtin_clzll(value);
+    shift = msb-LATENCY_SUB_BITS;
+    return (shift+1)*LATENCY_SUB_BUCKETS + (int)((value >> shift) & (LATENCY_SUB_BUCKETS-1));
+}
+
+static inline uint64_t latencyBucketHighest(int bucket){
+    //highest value mapped to the bucket
+    int shift;
+    uint64_t low;
+
+    if(bucket < LATENCY_SUB_BUCKETS) return bucket;
+    shift = bucket/LATENCY_SUB_BUCKETS-1;
+    low = (uint64_t)(bucket%LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) << shift;
+    return low + (((uint64_t)1 << shift)-1);
+}
+
+void latencyHistogramRecord(latencyHistogram *h, uint64_t value){
+    //only the owner thread writes: plain increments published with
+    //relaxed stores, so concurrent readers never see torn counters
+    int b = latencyBucket(value);
+
+    __atomic_store_n(&h->counts[b], h->counts[b]+1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->total, h->total+1, __ATOMIC_RELAXED);
+    if(value > h->max) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+void latencyHistogramMerge(latencyHistogram *dst, const latencyHistogram *src){
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    int j;
+
+    for(j = 0; j < LATENCY_BUCKETS; j++){
+        uint64_t c = __atomic_load_n(&src->counts[j], __ATOMIC_RELAXED);
+        dst->counts[j] += c;
+        dst->total += c;
+    }
+    if(max > dst->max) dst->max = max;
+}
+
+uint64_t latencyHistogramPercentile(const latencyHistogram *h, double percentile){
+    //value below which 'percentile' percent of the samples fall
+    uint64_t target, seen = 0;
+    int j;
+
+    if(h->total == 0) return 0;
+    target = (uint64_t)(percentile/100*h->total+0.5);
+    if(target == 0) target = 1;
+    for(j = 0; j < LATENCY_BUCKETS; j++){
+        seen += h->counts[j];
+        if(seen >= target){
+            uint64_t v = latencyBucketHighest(j);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+void latencyHistogramReset(latencyHistogram *h){
+    memset(h, 0, sizeof(*h));
+}
+
+/*-----------------------------Events-------------------------*/
+/* Histograms of a thread, allocated on first use of each event. Records
+ * are never freed, so the samples of exited threads are still reported. */
+typedef struct latencyThread {
+    struct latencyThread *next;
+    latencyHistogram *events[LATENCY_MAX_EVENTS];
+} latencyThread;
+
+int latency_enabled = 0;
+unsigned int latency_sample_mask = LATENCY_SAMPLE_RATE-1;
+__thread unsigned int latency_sample_tick = 0;
+int latency_tsc = 0;
+double latency_ns_per_tick = 1;
+static latencyThread *latency_threads = NULL;
+static __thread latencyThread *latency_self = NULL;
+static pthread_mutex_t latency_events_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int latency_numevents = LATENCY_STATIC_EVENTS;
+static char *latency_event_names[LATENCY_MAX_EVENTS] = {
+    "zmalloc",
+    "zrealloc",
+    "sds_makeroom"
+};
+
+static void latencyCalibrate(void){
+    //use the TSC if it is invariant, measuring its frequency once against
+    //the monotonic clock over a few milliseconds
+#if defined(LATENCY_TSC)
+    static int calibrated = 0;
+    unsigned int eax, ebx, ecx, edx;
+    struct timespec pause = {0, 5000000};
+    uint64_t t0, c0;
+
+    if(calibrated) return;
+    calibrated = 1;
+    if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1<<8))) return;
+    t0 = latencyNow();
+    c0 = __rdtsc();
+    nanosleep(&pause, NULL);
+    latency_ns_per_tick = (double)(latencyNow()-t0)/(__rdtsc()-c0);
+    latency_tsc = 1;
+#endif
+}
+
+static unsigned long long latencyHookStart(void){
+    //hooks of the modules that must not depend on this one: 0 skips the
+    //sample, as in latencyStartSample()
+    uint64_t start;
+
+    latencyStartSample(start);
+    return start;
+}
+
+static void latencyZmallocEnd(int event, unsigned long long start){
+    latencyEndSample(event == ZMALLOC_EVENT_REALLOC ?
+        LATENCY_EVENT_ZREALLOC : LATENCY_EVENT_ZMALLOC, start);
+}
+
+static void latencySdsEnd(unsigned long long start){
+    latencyEndSample(LATENCY_EVENT_SDS_MAKEROOM, start);
+}
+
+void latencySetEnabled(int enabled){
+    if(enabled) latencyCalibrate();
+    latency_enabled = enabled;
+    if(enabled){
+        zmalloc_set_latency_hooks(latencyHookStart, latencyZmallocEnd);
+        sdsSetLatencyHooks(latencyHookStart, latencySdsEnd);
+    }
+    else{
+        zmalloc_set_latency_hooks(NULL, NULL);
+        sdsSetLatencyHooks(NULL, NULL);
+    }
+}
+
+void latencySetSampleRate(unsigned int rate){
+    //time one event out of 'rate', rounded up to a power of two
+    unsigned int pow = 1;
+
+    while(pow < rate) pow <<= 1;
+    latency_sample_mask = pow-1;
+}
+
+int latencyRegisterEvent(const char *name){
+    //returns the id of a new event, or -1 if the table is full
+    int id = -1;
+
+    pthread_mutex_lock(&latency_events_mutex);
+    if(latency_numevents < LATENCY_MAX_EVENTS){
+        id = latency_numevents;
+        latency_event_names[id] = zstrdup(name);
+        __atomic_store_n(&latency_numevents, id+1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&latency_events_mutex);
+    return id;
+}
+
+uint64_t latencyNow(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void latencyRecord(int event, uint64_t ns){
+    //events that could not be registered (-1) are not recorded
+    latencyThread *t = latency_self;
+    latencyHistogram *h;
+
+    if(event < 0 || event >= LATENCY_MAX_EVENTS) return;
+    if(t == NULL){
+        t = zcalloc(sizeof(*t));
+        t->next = __atomic_load_n(&latency_threads, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&latency_threads, &t->next, t, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        latency_self = t;
+    }
+    h = t->events[event];
+    if(h == NULL){
+        //below ZMALLOC_LATENCY_MIN_SIZE, so this does not record itself
+        h = zcalloc(sizeof(*h));
+        __atomic_store_n(&t->events[event], h, __ATOMIC_RELEASE);
+    }
+    latencyHistogramRecord(h, ns);
+}
+
+static void latencyMergeEvent(int event, latencyHistogram *dst){
+    //sum the histograms of all the threads for the given event
+    latencyThread *t;
+
+    latencyHistogramReset(dst);
+    for(t = __atomic_load_n(&latency_threads, __ATOMIC_ACQUIRE); t; t = t->next){
+        latencyHistogram *h = __atomic_load_n(&t->events[event], __ATOMIC_ACQUIRE);
+        if(h) latencyHistogramMerge(dst, h);
+    }
+}
+
+sds latencyInfoString(sds info){
+    //append the latency section of INFO, values in microseconds
+    latencyHistogram *h = zmalloc(sizeof(*h));
+    int j, numevents = __atomic_load_n(&latency_numevents, __ATOMIC_ACQUIRE);
+
+    info = sdscatprintf(info, "# Latency\r\nlatency_tracking:%d\r\nlatency_sample_rate:%u\r\n",
+        latency_enabled, latency_sample_mask+1);
+    for(j = 0; j < numevents; j++){
+        latencyMergeEvent(j, h);
+        if(h->total == 0) continue;
+        info = sdscatprintf(info,
+            "latency_%s:samples=%llu,p50=%.3f,p99=%.3f,p999=%.3f,max=%.3f\r\n",
+            latency_event_names[j],
+            (unsigned long long)h->total,
+            latencyHistogramPercentile(h, 50)/1000.0,
+            latencyHistogramPercentile(h, 99)/1000.0,
+            latencyHistogramPercentile(h, 99.9)/1000.0,
+            h->max/1000.0);
+    }
+    zfree(h);
+    return info;
+}
+
+sds latencyDumpJson(sds s){
+    //machine readable dump, values in nanoseconds
+    latencyHistogram *h = zmalloc(sizeof(*h));
+    int j, first = 1, numevents = __atomic_load_n(&latency_numevents, __ATOMIC_ACQUIRE);
+
+    s = sdscat(s, "{");
+    for(j = 0; j < numevents; j++){
+        latencyMergeEvent(j, h);
+        if(h->total == 0) continue;
+        s = sdscatprintf(s,
+            "%s\"%s\":{\"samples\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+            first ? "" : ",",
+            latency_event_names[j],
+            (unsigned long long)h->total,
+            (unsigned long long)latencyHistogramPercentile(h, 50),
+            (unsigned long long)latencyHistogramPercentile(h, 99),
+            (unsigned long long)latencyHistogramPercentile(h, 99.9),
+            (unsigned long long)h->max);
+        first = 0;
+    }
+    zfree(h);
+    return sdscat(s, "}");
+}
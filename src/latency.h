@@ -0,0 +1,81 @@
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <stdint.h>
+#include "xsds.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <x86intrin.h>
+#define LATENCY_TSC 1
+#endif
+
+/* Log-linear histogram in the HDR style: values below 16 have their own
+ * bucket, larger values are bucketed by power of two and then linearly in
+ * 16 sub buckets, so every bucket is within 1/16 of the values it holds. */
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1<<LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64-LATENCY_SUB_BITS+1)*LATENCY_SUB_BUCKETS)
+
+typedef struct latencyHistogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} latencyHistogram;
+
+void latencyHistogramRecord(latencyHistogram *h, uint64_t value);
+void latencyHistogramMerge(latencyHistogram *dst, const latencyHistogram *src);
+uint64_t latencyHistogramPercentile(const latencyHistogram *h, double percentile);
+void latencyHistogramReset(latencyHistogram *h);
+
+/* Events timed by the server. Every thread records in its own histograms
+ * without locks; readers merge them on demand. Events past the static ones
+ * are registered at startup, for instance one per command. */
+#define LATENCY_EVENT_ZMALLOC 0         /* zmalloc/zcalloc of large sizes */
+#define LATENCY_EVENT_ZREALLOC 1        /* zrealloc of large sizes */
+#define LATENCY_EVENT_SDS_MAKEROOM 2    /* sdsMakeRoomFor reallocations */
+#define LATENCY_STATIC_EVENTS 3
+#define LATENCY_MAX_EVENTS 128
+
+/* Only one event every 'sample rate' is timed, per thread, so that the
+ * two clock reads and the record are paid by a small fraction of the
+ * calls. Samples are read from the TSC when it is invariant, and converted
+ * to nanoseconds when recorded. */
+#define LATENCY_SAMPLE_RATE 16
+
+extern int latency_enabled;
+extern unsigned int latency_sample_mask;
+extern __thread unsigned int latency_sample_tick;
+extern int latency_tsc;
+extern double latency_ns_per_tick;
+
+void latencySetEnabled(int enabled);
+void latencySetSampleRate(unsigned int rate);
+int latencyRegisterEvent(const char *name);
+uint64_t latencyNow(void);
+void latencyRecord(int event, uint64_t ns);
+sds latencyInfoString(sds info);
+sds latencyDumpJson(sds s);
+
+static inline uint64_t latencyTicks(void) {
+#if defined(LATENCY_TSC)
+    if (latency_tsc) return __rdtsc();
+#endif
+    return latencyNow();
+}
+
+static inline uint64_t latencyTicksToNs(uint64_t ticks) {
+    return (uint64_t)(ticks*latency_ns_per_tick);
+}
+
+/* Time a block of code if tracking is enabled and the call is sampled,
+ * otherwise the cost is a test and a thread local increment. */
+#define latencyStartSample(var) do { \
+    var = (latency_enabled && \
+           (++latency_sample_tick & latency_sample_mask) == 0) ? latencyTicks() : 0; \
+} while(0)
+
+#define latencyEndSample(event,var) do { \
+    if (var) latencyRecord((event),latencyTicksToNs(latencyTicks()-(var))); \
+} while(0)
+
+#endif /* __LATENCY_H */
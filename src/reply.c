@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "reply.h"
+#include "zmalloc.h"
+
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define REPLY_MAX_IOV IOV_MAX
+#else
+#define REPLY_MAX_IOV 64
+#endif
+
+/* Blocks come from zmalloc, so both the queued and the pooled ones are part
+ * of used_memory; pooled_memory tells how much of it is idle in the pools. */
+static __thread replyBlock *reply_pool = NULL;
+static __thread int reply_pool_len = 0;
+static size_t pooled_memory = 0;
+
+static replyLimit reply_limits[REPLY_CLASS_COUNT] = {
+    {0, 0, 0},                                  /* normal */
+    {256*1024*1024, 64*1024*1024, 60},          /* replica */
+    {32*1024*1024, 8*1024*1024, 60}             /* pubsub */
+};
+
+/*-----------------------------Pool-------------------------*/
+static replyBlock *replyBlockGet(void){
+    replyBlock *b = reply_pool;
+
+    if(b){
+        reply_pool = b->next;
+        reply_pool_len--;
+        __atomic_sub_fetch(&pooled_memory, zmalloc_size(b), __ATOMIC_RELAXED);
+    }
+    else{
+        b = zmalloc(sizeof(*b));
+    }
+    b->next = NULL;
+    b->used = 0;
+    return b;
+}
+
+static void replyBlockPut(replyBlock *b){
+    if(reply_pool_len >= REPLY_POOL_MAX_BLOCKS){
+        zfree(b);
+        return;
+    }
+    b->next = reply_pool;
+    reply_pool = b;
+    reply_pool_len++;
+    __atomic_add_fetch(&pooled_memory, zmalloc_size(b), __ATOMIC_RELAXED);
+}
+
+size_t replyPoolMemory(void){
+    //bytes cached by the pools of all the threads
+    return __atomic_load_n(&pooled_memory, __ATOMIC_RELAXED);
+}
+
+void replyPoolFlush(void){
+    //free the blocks cached by the calling thread, called on thread exit
+    while(reply_pool){
+        replyBlock *b = reply_pool;
+        reply_pool = b->next;
+        __atomic_sub_fetch(&pooled_memory, zmalloc_size(b), __ATOMIC_RELAXED);
+        zfree(b);
+    }
+    reply_pool_len = 0;
+}
+
+/*-----------------------------Chains-------------------------*/
+void replyChainInit(replyChain *c){
+    c->head = c->tail = NULL;
+    c->sentpos = 0;
+    c->bytes = 0;
+    c->nblocks = 0;
+    c->memory = 0;
+    c->soft_limit_reached_time = 0;
+}
+
+void replyChainAppend(replyChain *c, const void *buf, size_t len){
+    //fill the tail block, then chain new ones; queued bytes never move
+    const char *p = buf;
+
+    c->bytes += len;
+    while(len){
+        size_t n;
+
+        if(c->tail == NULL || c->tail->used == REPLY_BLOCK_SIZE){
+            replyBlock *b = replyBlockGet();
+            if(c->tail) c->tail->next = b;
+            else c->head = b;
+            c->tail = b;
+            c->nblocks++;
+            c->memory += zmalloc_size(b);
+        }
+        n = REPLY_BLOCK_SIZE-c->tail->used;
+        if(n > len) n = len;
+        memcpy(c->tail->buf+c->tail->used, p, n);
+        c->tail->used += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void replyChainAppendSds(replyChain *c, const sds s){
+    replyChainAppend(c, s, sdslen(s));
+}
+
+ssize_t replyChainWrite(replyChain *c, int fd){
+    //write as many queued blocks as possible with a single writev(), and
+    //return the written blocks to the pool. Returns the bytes written, or -1
+    //with errno set (EAGAIN included).
+    struct iovec iov[REPLY_MAX_IOV];
+    replyBlock *b;
+    ssize_t nwritten, left;
+    int iovcnt = 0;
+
+    if(c->bytes == 0) return 0;
+    for(b = c->head; b && iovcnt < REPLY_MAX_IOV; b = b->next){
+        size_t start = (b == c->head) ? c->sentpos : 0;
+        iov[iovcnt].iov_base = b->buf+start;
+        iov[iovcnt].iov_len = b->used-start;
+        iovcnt++;
+    }
+
+    nwritten = writev(fd, iov, iovcnt);
+    if(nwritten <= 0) return nwritten;
+
+    c->bytes -= nwritten;
+    left = nwritten;
+    //fully written blocks, the tail included, go back to the pool so that
+    //an idle client keeps no block at all
+    while(left > 0){
+        size_t pending = c->head->used-c->sentpos;
+
+        if((size_t)left < pending){
+            c->sentpos += left;
+            break;
+        }
+        left -= pending;
+        b = c->head;
+        c->head = b->next;
+        if(c->head == NULL) c->tail = NULL;
+        c->sentpos = 0;
+        c->nblocks--;
+        c->memory -= zmalloc_size(b);
+        replyBlockPut(b);
+    }
+    return nwritten;
+}
+
+void replyChainRelease(replyChain *c){
+    //drop everything queued, for instance when the client is freed
+    while(c->head){
+        replyBlock *b = c->head;
+        c->head = b->next;
+        replyBlockPut(b);
+    }
+    replyChainInit(c);
+}
+
+size_t replyChainMemory(const replyChain *c){
+    //bytes allocated for the queued blocks, as accounted by zmalloc
+    return c->memory;
+}
+
+void replySetLimit(int class, size_t hard, size_t soft, time_t seconds){
+    //0 disables the corresponding limit
+    reply_limits[class].hard_limit_bytes = hard;
+    reply_limits[class].soft_limit_bytes = soft;
+    reply_limits[class].soft_limit_seconds = seconds;
+}
+
+int replyChainCheckLimits(replyChain *c, int class, time_t now){
+    //returns 1 if the client must be disconnected: its output buffer reached
+    //the hard limit, or stayed over the soft limit for too long
+    replyLimit *l = &reply_limits[class];
+    size_t used = replyChainMemory(c);
+
+    if(l->hard_limit_bytes && used >= l->hard_limit_bytes) return 1;
+    if(l->soft_limit_bytes && used >= l->soft_limit_bytes){
+        if(c->soft_limit_reached_time == 0){
+            c->soft_limit_reached_time = now;
+            return 0;
+        }
+        return now-c->soft_limit_reached_time >= l->soft_limit_seconds;
+    }
+    c->soft_limit_reached_time = 0;
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef __REPLY_H
+#define __REPLY_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "xsds.h"
+
+/* Client output buffers are chains of fixed size blocks instead of a single
+ * growing sds: a large reply never reallocates what is already queued, and
+ * every block is handed back to a per thread pool as soon as it is written,
+ * so idle clients do not pin memory. */
+#define REPLY_BLOCK_SIZE (16*1024)
+#define REPLY_POOL_MAX_BLOCKS 256   /* Blocks cached by each thread. */
+
+typedef struct replyBlock {
+    struct replyBlock *next;
+    size_t used;
+    char buf[REPLY_BLOCK_SIZE];
+} replyBlock;
+
+typedef struct replyChain {
+    replyBlock *head, *tail;
+    size_t sentpos;         /* Bytes of 'head' already written. */
+    size_t bytes;           /* Bytes queued and not yet written. */
+    size_t nblocks;
+    size_t memory;          /* zmalloc_size() of the blocks. */
+    time_t soft_limit_reached_time;
+} replyChain;
+
+/* Client classes, each with its own output buffer limits. */
+#define REPLY_CLASS_NORMAL 0
+#define REPLY_CLASS_REPLICA 1
+#define REPLY_CLASS_PUBSUB 2
+#define REPLY_CLASS_COUNT 3
+
+typedef struct replyLimit {
+    size_t hard_limit_bytes;    /* Disconnect as soon as this is reached. */
+    size_t soft_limit_bytes;    /* Disconnect if this is exceeded for... */
+    time_t soft_limit_seconds;  /* ...this many seconds in a row. */
+} replyLimit;
+
+void replyChainInit(replyChain *c);
+void replyChainAppend(replyChain *c, const void *buf, size_t len);
+void replyChainAppendSds(replyChain *c, const sds s);
+ssize_t replyChainWrite(replyChain *c, int fd);
+void replyChainRelease(replyChain *c);
+size_t replyChainMemory(const replyChain *c);
+void replySetLimit(int class, size_t hard, size_t soft, time_t seconds);
+int replyChainCheckLimits(replyChain *c, int class, time_t now);
+size_t replyPoolMemory(void);
+void replyPoolFlush(void);
+
+#endif /* __REPLY_H */
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rope.h"
+#include "zmalloc.h"
+
+/*-----------------------------Internals-------------------------*/
+static void ropeAddChunk(rope *r){
+    //append an empty chunk, the index grows geometrically so that appends
+    //stay O(1) amortized
+    if(r->nchunks == r->slots){
+        r->slots = r->slots ? r->slots*2 : 16;
+        r->chunks = zrealloc(r->chunks, sizeof(char *)*r->slots);
+    }
+    r->chunks[r->nchunks++] = zmalloc(ROPE_CHUNK_SIZE);
+}
+
+static void ropeAppendInternal(rope *r, const void *buf, size_t len){
+    //append len bytes of buf, or len zero bytes if buf is NULL
+    const char *p = buf;
+
+    while(len){
+        size_t end = r->head+r->len, off = end%ROPE_CHUNK_SIZE, n;
+
+        if(end == r->nchunks*ROPE_CHUNK_SIZE){
+            ropeAddChunk(r);
+            off = 0;
+        }
+        n = ROPE_CHUNK_SIZE-off;
+        if(n > len) n = len;
+        if(p){
+            memcpy(r->chunks[r->nchunks-1]+off, p, n);
+            p += n;
+        }
+        else{
+            memset(r->chunks[r->nchunks-1]+off, 0, n);
+        }
+        r->len += n;
+        len -= n;
+    }
+}
+
+static void ropeCopyOut(const rope *r, size_t offset, size_t len, char *dst){
+    //copy len bytes starting at offset, touching only the needed chunks
+    size_t v = r->head+offset;
+
+    while(len){
+        size_t off = v%ROPE_CHUNK_SIZE, n = ROPE_CHUNK_SIZE-off;
+
+        if(n > len) n = len;
+        memcpy(dst, r->chunks[v/ROPE_CHUNK_SIZE]+off, n);
+        dst += n;
+        v += n;
+        len -= n;
+    }
+}
+
+static int ropeNormalizeRange(size_t len, long *start, long *end){
+    //apply the sdsrange() index rules, returns 0 if the range is empty
+    if(*start < 0) *start += len;
+    if(*end < 0) *end += len;
+    if((*start > *end) || (*start >= (long)len) || (*end < 0)){
+        return 0;
+    }
+    if(*start < 0) *start = 0;
+    if(*end >= (long)len) *end = len-1;
+    return 1;
+}
+
+/*-----------------------------APIs-------------------------*/
+rope *ropeCreate(void){
+    rope *r = zmalloc(sizeof(*r));
+
+    r->chunks = NULL;
+    r->nchunks = 0;
+    r->slots = 0;
+    r->head = 0;
+    r->len = 0;
+    return r;
+}
+
+rope *ropeFromSds(sds s){
+    //convert a plain sds value, s is freed
+    rope *r = ropeCreate();
+
+    ropeAppendInternal(r, s, sdslen(s));
+    sdsfree(s);
+    return r;
+}
+
+void ropeFree(rope *r){
+    size_t j;
+
+    if(r == NULL) return;
+    for(j = 0; j < r->nchunks; j++){
+        zfree(r->chunks[j]);
+    }
+    zfree(r->chunks);
+    zfree(r);
+}
+
+size_t ropeLen(const rope *r){
+    return r->len;
+}
+
+int ropeShouldConvert(const sds s){
+    //values reaching ROPE_MIN_SIZE switch to the chunked representation
+    return sdslen(s) >= ROPE_MIN_SIZE;
+}
+
+void ropeAppend(rope *r, const void *buf, size_t len){
+    //APPEND: only the new bytes are copied
+    ropeAppendInternal(r, buf, len);
+}
+
+void ropeSetRange(rope *r, size_t offset, const void *buf, size_t len){
+    //SETRANGE: overwrite from offset, zero filling the gap past the end.
+    //An empty value leaves the string untouched, even past its end.
+    const char *p = buf;
+    size_t v;
+
+    if(len == 0) return;
+    if(offset > r->len){
+        ropeAppendInternal(r, NULL, offset-r->len);
+    }
+    v = r->head+offset;
+    while(len && offset < r->len){
+        size_t off = v%ROPE_CHUNK_SIZE, n = ROPE_CHUNK_SIZE-off;
+
+        if(n > len) n = len;
+        if(n > r->len-offset) n = r->len-offset;
+        memcpy(r->chunks[v/ROPE_CHUNK_SIZE]+off, p, n);
+        p += n;
+        v += n;
+        offset += n;
+        len -= n;
+    }
+    ropeAppendInternal(r, p, len);
+}
+
+sds ropeGetRange(const rope *r, long start, long end){
+    //GETRANGE: copy the inclusive range [start,end] into a new sds
+    sds s;
+
+    if(!ropeNormalizeRange(r->len, &start, &end)){
+        return sdsempty();
+    }
+    s = sdsnewlen(NULL, end-start+1);
+    ropeCopyOut(r, start, end-start+1, s);
+    return s;
+}
+
+int ropeRangeIovec(const rope *r, size_t offset, size_t len, struct iovec *iov, int iovcnt){
+    //point up to iovcnt entries at the bytes [offset, offset+len) so that a
+    //reply can be written without copying; returns the entries used, the
+    //caller loops when the range spans more chunks than iovcnt
+    size_t v = r->head+offset;
+    int j = 0;
+
+    if(offset >= r->len) return 0;
+    if(len > r->len-offset) len = r->len-offset;
+    while(len && j < iovcnt){
+        size_t off = v%ROPE_CHUNK_SIZE, n = ROPE_CHUNK_SIZE-off;
+
+        if(n > len) n = len;
+        iov[j].iov_base = r->chunks[v/ROPE_CHUNK_SIZE]+off;
+        iov[j].iov_len = n;
+        j++;
+        v += n;
+        len -= n;
+    }
+    return j;
+}
+
+void ropeRange(rope *r, long start, long end){
+    //same as sdsrange(), but the chunks outside the range are released
+    //instead of moving the retained bytes to the front
+    size_t first, last, j;
+
+    if(!ropeNormalizeRange(r->len, &start, &end)){
+        return;
+    }
+    first = (r->head+start)/ROPE_CHUNK_SIZE;
+    last = (r->head+end)/ROPE_CHUNK_SIZE;
+    for(j = last+1; j < r->nchunks; j++){
+        zfree(r->chunks[j]);
+    }
+    for(j = 0; j < first; j++){
+        zfree(r->chunks[j]);
+    }
+    if(first){
+        memmove(r->chunks, r->chunks+first, sizeof(char *)*(last-first+1));
+    }
+    r->nchunks = last-first+1;
+    r->head = (r->head+start)%ROPE_CHUNK_SIZE;
+    r->len = end-start+1;
+}
+
+size_t ropeAllocSize(const rope *r){
+    //memory used by the rope, as accounted by zmalloc
+    size_t size = zmalloc_size((void *)r), j;
+
+    if(r->chunks) size += zmalloc_size(r->chunks);
+    for(j = 0; j < r->nchunks; j++){
+        size += zmalloc_size(r->chunks[j]);
+    }
+    return size;
+}
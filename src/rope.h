@@ -0,0 +1,36 @@
+#ifndef __ROPE_H
+#define __ROPE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "xsds.h"
+
+/* String values whose length reaches ROPE_MIN_SIZE are kept as a chain of
+ * ROPE_CHUNK_SIZE blocks instead of one contiguous sds: appending never
+ * copies the bytes already stored, and a range only touches the chunks
+ * that overlap it. Every chunk is full except the first one, that may start
+ * at 'head' after a front trim, and the last one. */
+#define ROPE_CHUNK_SIZE (64*1024)
+#define ROPE_MIN_SIZE (4*1024*1024)
+
+typedef struct rope {
+    char **chunks;          /* Chunk index, chunks[i] holds ROPE_CHUNK_SIZE bytes. */
+    size_t nchunks;         /* Chunks in use. */
+    size_t slots;           /* Allocated entries of 'chunks'. */
+    size_t head;            /* Offset of the first byte inside chunks[0]. */
+    size_t len;             /* Length of the string. */
+} rope;
+
+rope *ropeCreate(void);
+rope *ropeFromSds(sds s);
+void ropeFree(rope *r);
+size_t ropeLen(const rope *r);
+int ropeShouldConvert(const sds s);
+void ropeAppend(rope *r, const void *buf, size_t len);
+void ropeSetRange(rope *r, size_t offset, const void *buf, size_t len);
+sds ropeGetRange(const rope *r, long start, long end);
+int ropeRangeIovec(const rope *r, size_t offset, size_t len, struct iovec *iov, int iovcnt);
+void ropeRange(rope *r, long start, long end);
+size_t ropeAllocSize(const rope *r);
+
+#endif /* __ROPE_H */
@@ -0,0 +1,575 @@
+/* subaru-benchmark - multi threaded load generator for Subaru.
+ *
+ * Every thread drives its own connections with epoll: a connection sends a
+ * batch of 'pipeline' requests, waits for all the replies, then sends the
+ * next batch. The latency of a request is the time between the write of
+ * its batch and the parsing of its reply. Connections are only allowed to
+ * loopback addresses: this tool measures the server, not the network. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "xsds.h"
+#include "zmalloc.h"
+#include "latency.h"
+
+#define CMD_GET 0
+#define CMD_SET 1
+#define CMD_INCR 2
+#define CMD_LPUSH 3
+#define CMD_ZADD 4
+#define CMD_COUNT 5
+
+static const char *cmdnames[CMD_COUNT] = {"get","set","incr","lpush","zadd"};
+
+static struct config {
+    char *hostip;
+    int hostport;
+    int threads;
+    int clients;            /* Connections per thread. */
+    long long requests;
+    int pipeline;
+    long long keyspace;
+    size_t datamin, datamax;
+    int zipf;
+    double theta;
+    int mix[CMD_COUNT];     /* Weight of every command. */
+    int mixtotal;
+    int json;
+    unsigned long long seed;
+
+    /* Zipf generator constants, computed once. */
+    double zetan, alpha, eta;
+    char *payload;
+
+    long long issued;       /* Requests claimed by the connections. */
+} config;
+
+typedef struct conn {
+    int fd;
+    sds obuf;
+    size_t opos;
+    sds ibuf;
+    int pending;            /* Replies still expected for the batch. */
+    uint64_t sent;          /* Time the batch was written. */
+    const char *err;        /* Why the connection failed. */
+} conn;
+
+typedef struct worker {
+    pthread_t tid;
+    int efd;
+    conn *conns;
+    unsigned long long rng;
+    latencyHistogram hist;
+    long long done;
+    long long errors;
+    long long percmd[CMD_COUNT];
+} worker;
+
+/*-----------------------------Random keys-------------------------*/
+static uint64_t rngNext(unsigned long long *s){
+    //xorshift64*
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double rngDouble(unsigned long long *s){
+    return (rngNext(s) >> 11) * (1.0/9007199254740992.0);
+}
+
+static void zipfInit(void){
+    //Gray et al. "Quickly generating billion-record synthetic databases"
+    double zeta2 = 0;
+    long long i;
+
+    config.zetan = 0;
+    for(i = 1; i <= config.keyspace; i++) config.zetan += 1.0/pow((double)i, config.theta);
+    for(i = 1; i <= 2; i++) zeta2 += 1.0/pow((double)i, config.theta);
+    config.alpha = 1.0/(1.0-config.theta);
+    config.eta = (1-pow(2.0/config.keyspace, 1-config.theta))/(1-zeta2/config.zetan);
+}
+
+static long long nextKey(worker *w){
+    double u, uz;
+
+    if(!config.zipf) return rngNext(&w->rng) % config.keyspace;
+    u = rngDouble(&w->rng);
+    uz = u*config.zetan;
+    if(uz < 1) return 0;
+    if(uz < 1+pow(0.5, config.theta)) return 1;
+    return (long long)(config.keyspace*pow(config.eta*u-config.eta+1, config.alpha)) % config.keyspace;
+}
+
+static int nextCommand(worker *w){
+    int r = rngNext(&w->rng) % config.mixtotal, j;
+
+    for(j = 0; j < CMD_COUNT; j++){
+        if(r < config.mix[j]) return j;
+        r -= config.mix[j];
+    }
+    return CMD_GET;
+}
+
+/*-----------------------------Protocol-------------------------*/
+static sds catArg(sds s, const char *arg, size_t len){
+    s = sdscatprintf(s, "$%zu\r\n", len);
+    s = sdscatlen(s, len, (char *)arg);
+    return sdscatlen(s, 2, "\r\n");
+}
+
+static sds catRequest(worker *w, sds s){
+    char key[64], member[32];
+    int cmd = nextCommand(w), klen;
+    size_t vlen = config.datamin;
+
+    if(config.datamax > config.datamin){
+        vlen += rngNext(&w->rng) % (config.datamax-config.datamin+1);
+    }
+    w->percmd[cmd]++;
+    switch(cmd){
+    case CMD_GET:
+    case CMD_SET:
+        klen = snprintf(key, sizeof(key), "key:%012lld", nextKey(w));
+        break;
+    case CMD_INCR:
+        klen = snprintf(key, sizeof(key), "counter:%012lld", nextKey(w));
+        break;
+    case CMD_LPUSH:
+        klen = snprintf(key, sizeof(key), "list:%012lld", nextKey(w));
+        break;
+    default:
+        klen = snprintf(key, sizeof(key), "zset:%012lld", nextKey(w));
+        break;
+    }
+
+    switch(cmd){
+    case CMD_GET:
+    case CMD_INCR:
+        s = sdscatprintf(s, "*2\r\n");
+        s = catArg(s, cmdnames[cmd], strlen(cmdnames[cmd]));
+        return catArg(s, key, klen);
+    case CMD_SET:
+    case CMD_LPUSH:
+        s = sdscatprintf(s, "*3\r\n");
+        s = catArg(s, cmdnames[cmd], strlen(cmdnames[cmd]));
+        s = catArg(s, key, klen);
+        return catArg(s, config.payload, vlen);
+    default:
+        s = sdscatprintf(s, "*4\r\n");
+        s = catArg(s, "zadd", 4);
+        s = catArg(s, key, klen);
+        s = catArg(s, member, snprintf(member, sizeof(member), "%llu",
+            (unsigned long long)(rngNext(&w->rng) % 1000000)));
+        return catArg(s, member, snprintf(member, sizeof(member), "m:%llu",
+            (unsigned long long)(rngNext(&w->rng) % config.keyspace)));
+    }
+}
+
+static long replyLen(const char *p, size_t len, int *err){
+    //length of the complete reply at p, 0 if more data is needed, -1 if the
+    //reply is malformed. *err is set for error replies.
+    const char *nl = memchr(p, '\n', len);
+    long hdr, n, j, used;
+
+    if(len == 0 || nl == NULL) return 0;
+    hdr = nl-p+1;
+    switch(p[0]){
+    case '-':
+        *err = 1;
+        /* fall through */
+    case '+':
+    case ':':
+        return hdr;
+    case '$':
+        n = strtol(p+1, NULL, 10);
+        if(n < 0) return hdr;
+        return (size_t)(hdr+n+2) <= len ? hdr+n+2 : 0;
+    case '*':
+        n = strtol(p+1, NULL, 10);
+        used = hdr;
+        for(j = 0; j < n; j++){
+            long l = replyLen(p+used, len-used, err);
+            if(l <= 0) return l;
+            used += l;
+        }
+        return used;
+    default:
+        return -1;
+    }
+}
+
+/*-----------------------------Connections-------------------------*/
+static int connectLoopback(void){
+    struct sockaddr_in sa;
+    int fd, yes = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(config.hostport);
+    inet_pton(AF_INET, config.hostip, &sa.sin_addr);
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) return -1;
+    if(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1){
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+    return fd;
+}
+
+static void setWritable(worker *w, conn *c, int writable){
+    struct epoll_event ee;
+
+    ee.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+    ee.data.ptr = c;
+    epoll_ctl(w->efd, EPOLL_CTL_MOD, c->fd, &ee);
+}
+
+static int connFlush(worker *w, conn *c){
+    //write what is left of the batch, returns -1 on error
+    while(c->opos < sdslen(c->obuf)){
+        ssize_t n = write(c->fd, c->obuf+c->opos, sdslen(c->obuf)-c->opos);
+        if(n == -1){
+            if(errno == EAGAIN){
+                setWritable(w, c, 1);
+                return 0;
+            }
+            c->err = strerror(errno);
+            return -1;
+        }
+        c->opos += n;
+    }
+    setWritable(w, c, 0);
+    return 0;
+}
+
+static int connSendBatch(worker *w, conn *c){
+    //claim up to 'pipeline' requests, returns 0 if there are none left
+    long long first = __atomic_fetch_add(&config.issued, config.pipeline, __ATOMIC_RELAXED);
+    long long n = config.requests-first;
+    int j;
+
+    if(n <= 0) return 0;
+    if(n > config.pipeline) n = config.pipeline;
+    sdsclear(c->obuf);
+    c->opos = 0;
+    for(j = 0; j < n; j++) c->obuf = catRequest(w, c->obuf);
+    c->pending = n;
+    c->sent = latencyNow();
+    return connFlush(w, c) == 0 ? 1 : -1;
+}
+
+static int connRead(worker *w, conn *c){
+    //read and parse replies, send the next batch when the current one is
+    //complete. Returns 1 while the connection is busy, 0 when done, -1 on
+    //errors.
+    long used = 0, l;
+    ssize_t n;
+
+    c->ibuf = sdsMakeRoomFor(c->ibuf, 16*1024);
+    n = read(c->fd, c->ibuf+sdslen(c->ibuf), sdsavail(c->ibuf));
+    if(n == 0){
+        c->err = "connection closed by the server";
+        return -1;
+    }
+    if(n == -1){
+        if(errno == EAGAIN) return 1;
+        c->err = strerror(errno);
+        return -1;
+    }
+    sdsIncrLen(c->ibuf, n);
+
+    while(c->pending){
+        int err = 0;
+        l = replyLen(c->ibuf+used, sdslen(c->ibuf)-used, &err);
+        if(l < 0){
+            c->err = "protocol error in the reply";
+            return -1;
+        }
+        if(l == 0) break;
+        used += l;
+        c->pending--;
+        w->done++;
+        w->errors += err;
+        latencyHistogramRecord(&w->hist, latencyNow()-c->sent);
+    }
+    if(used == (long)sdslen(c->ibuf)) sdsclear(c->ibuf);
+    else if(used) sdsrange(c->ibuf, used, -1);
+
+    if(c->pending) return 1;
+    return connSendBatch(w, c);
+}
+
+static void connFatal(conn *c){
+    fprintf(stderr, "Connection error: %s\n", c->err ? c->err : "unknown error");
+    exit(1);
+}
+
+static void *workerMain(void *arg){
+    worker *w = arg;
+    struct epoll_event events[256];
+    int active = 0, j;
+
+    for(j = 0; j < config.clients; j++){
+        conn *c = &w->conns[j];
+        struct epoll_event ee;
+
+        ee.events = EPOLLIN;
+        ee.data.ptr = c;
+        epoll_ctl(w->efd, EPOLL_CTL_ADD, c->fd, &ee);
+        switch(connSendBatch(w, c)){
+        case 1: active++; break;
+        case -1: connFatal(c); break;
+        }
+    }
+    while(active > 0){
+        int n = epoll_wait(w->efd, events, 256, 1000);
+        for(j = 0; j < n; j++){
+            conn *c = events[j].data.ptr;
+            int retval = 1;
+
+            if(events[j].events & EPOLLOUT) retval = connFlush(w, c) == 0 ? 1 : -1;
+            if(retval > 0 && (events[j].events & (EPOLLIN|EPOLLERR|EPOLLHUP))){
+                retval = connRead(w, c);
+            }
+            if(retval == -1) connFatal(c);
+            if(retval == 0){
+                epoll_ctl(w->efd, EPOLL_CTL_DEL, c->fd, NULL);
+                active--;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*-----------------------------Configuration-------------------------*/
+static int isLoopback(const char *ip){
+    struct in_addr a;
+
+    if(inet_pton(AF_INET, ip, &a) != 1) return 0;
+    return (ntohl(a.s_addr) >> 24) == 127;
+}
+
+static int parseMix(const char *spec){
+    //"get=50,set=40,incr=5,lpush=3,zadd=2"
+    int count, j, k;
+    sds *parts = sdssplitlen(spec, strlen(spec), ",", 1, &count);
+
+    if(parts == NULL) return -1;
+    memset(config.mix, 0, sizeof(config.mix));
+    config.mixtotal = 0;
+    for(j = 0; j < count; j++){
+        char *eq = strchr(parts[j], '=');
+        if(eq == NULL) goto err;
+        *eq = '\0';
+        sdsupdatelen(parts[j]);
+        for(k = 0; k < CMD_COUNT; k++){
+            if(!strcasecmp(parts[j], cmdnames[k])) break;
+        }
+        if(k == CMD_COUNT) goto err;
+        config.mix[k] = atoi(eq+1);
+        config.mixtotal += config.mix[k];
+    }
+    sdsfreesplitres(parts, count);
+    return config.mixtotal > 0 ? 0 : -1;
+
+err:
+    sdsfreesplitres(parts, count);
+    return -1;
+}
+
+static void usage(void){
+    fprintf(stderr,
+"Usage: subaru-benchmark [-h <host>] [-p <port>] [-t <threads>] [-c <clients>]\n"
+"       [-n <requests>] [-P <pipeline>] [-r <keyspace>] [-d <size>|<min>-<max>]\n"
+"       [--zipf <theta>] [--mix <cmd=weight,...>] [--seed <n>] [--json]\n\n"
+" -h <host>       Loopback address of the server (default 127.0.0.1)\n"
+" -p <port>       Server port (default 6379)\n"
+" -t <threads>    Number of threads (default 1)\n"
+" -c <clients>    Connections per thread (default 50)\n"
+" -n <requests>   Total number of requests (default 100000)\n"
+" -P <pipeline>   Requests sent per batch on every connection (default 1)\n"
+" -r <keyspace>   Number of distinct keys (default 100000)\n"
+" -d <size>       Value size in bytes, or a min-max uniform range (default 3)\n"
+" --zipf <theta>  Zipfian key selection with the given skew, e.g. 0.99\n"
+"                 (default is uniform)\n"
+" --mix <spec>    Command mix among get, set, incr, lpush and zadd\n"
+"                 (default get=50,set=50)\n"
+" --seed <n>      Seed of the random generators\n"
+" --json          Print the results as JSON\n");
+    exit(1);
+}
+
+static void parseOptions(int argc, char **argv){
+    int j;
+
+    for(j = 1; j < argc; j++){
+        int more = j+1 < argc;
+        char *a = argv[j];
+
+        if(!strcmp(a, "-h") && more) config.hostip = argv[++j];
+        else if(!strcmp(a, "-p") && more) config.hostport = atoi(argv[++j]);
+        else if(!strcmp(a, "-t") && more) config.threads = atoi(argv[++j]);
+        else if(!strcmp(a, "-c") && more) config.clients = atoi(argv[++j]);
+        else if(!strcmp(a, "-n") && more) config.requests = atoll(argv[++j]);
+        else if(!strcmp(a, "-P") && more) config.pipeline = atoi(argv[++j]);
+        else if(!strcmp(a, "-r") && more) config.keyspace = atoll(argv[++j]);
+        else if(!strcmp(a, "-d") && more){
+            char *dash = strchr(argv[++j], '-');
+            config.datamin = config.datamax = strtoull(argv[j], NULL, 10);
+            if(dash) config.datamax = strtoull(dash+1, NULL, 10);
+        }
+        else if(!strcmp(a, "--zipf") && more){
+            config.zipf = 1;
+            config.theta = strtod(argv[++j], NULL);
+        }
+        else if(!strcmp(a, "--mix") && more){
+            if(parseMix(argv[++j]) == -1){
+                fprintf(stderr, "Invalid --mix specification\n");
+                exit(1);
+            }
+        }
+        else if(!strcmp(a, "--seed") && more) config.seed = strtoull(argv[++j], NULL, 10);
+        else if(!strcmp(a, "--json")) config.json = 1;
+        else usage();
+    }
+
+    if(!isLoopback(config.hostip)){
+        fprintf(stderr, "Only loopback addresses (127.0.0.0/8) are allowed\n");
+        exit(1);
+    }
+    if(config.threads < 1 || config.clients < 1 || config.pipeline < 1 ||
+       config.requests < 1 || config.keyspace < 1 ||
+       config.datamax < config.datamin ||
+       (config.zipf && (config.theta <= 0 || config.theta >= 1))) usage();
+}
+
+/*-----------------------------Report-------------------------*/
+static void report(worker *workers, uint64_t elapsed){
+    latencyHistogram *h = zcalloc(sizeof(*h));
+    long long done = 0, errors = 0, percmd[CMD_COUNT] = {0};
+    double secs = elapsed/1e9;
+    int j, k;
+
+    for(j = 0; j < config.threads; j++){
+        latencyHistogramMerge(h, &workers[j].hist);
+        done += workers[j].done;
+        errors += workers[j].errors;
+        for(k = 0; k < CMD_COUNT; k++) percmd[k] += workers[j].percmd[k];
+    }
+
+    if(config.json){
+        sds s = sdscatprintf(sdsempty(),
+            "{\"config\":{\"threads\":%d,\"clients_per_thread\":%d,"
+            "\"pipeline\":%d,\"keyspace\":%lld,\"data_min\":%zu,"
+            "\"data_max\":%zu,\"distribution\":\"%s\",\"theta\":%.3f},"
+            "\"requests\":%lld,\"errors\":%lld,\"seconds\":%.3f,"
+            "\"ops_per_sec\":%.2f,\"commands\":{",
+            config.threads, config.clients, config.pipeline,
+            config.keyspace, config.datamin, config.datamax,
+            config.zipf ? "zipf" : "uniform", config.zipf ? config.theta : 0,
+            done, errors, secs, done/secs);
+        for(k = 0; k < CMD_COUNT; k++){
+            s = sdscatprintf(s, "%s\"%s\":%lld", k ? "," : "", cmdnames[k], percmd[k]);
+        }
+        s = sdscatprintf(s,
+            "},\"latency_us\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}}\n",
+            latencyHistogramPercentile(h, 50)/1000.0,
+            latencyHistogramPercentile(h, 99)/1000.0,
+            latencyHistogramPercentile(h, 99.9)/1000.0,
+            h->max/1000.0);
+        fputs(s, stdout);
+        sdsfree(s);
+    }
+    else{
+        printf("====== subaru-benchmark ======\n");
+        printf("  %lld requests in %.3f seconds (%lld errors)\n", done, secs, errors);
+        printf("  %d threads x %d connections, pipeline %d\n",
+            config.threads, config.clients, config.pipeline);
+        printf("  %lld keys, %s distribution, values of %zu-%zu bytes\n",
+            config.keyspace, config.zipf ? "zipfian" : "uniform",
+            config.datamin, config.datamax);
+        for(k = 0; k < CMD_COUNT; k++){
+            if(percmd[k]) printf("  %-6s %lld\n", cmdnames[k], percmd[k]);
+        }
+        printf("\n  throughput: %.2f requests per second\n", done/secs);
+        printf("  latency (usec): p50 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+            latencyHistogramPercentile(h, 50)/1000.0,
+            latencyHistogramPercentile(h, 99)/1000.0,
+            latencyHistogramPercentile(h, 99.9)/1000.0,
+            h->max/1000.0);
+    }
+    zfree(h);
+}
+
+int main(int argc, char **argv){
+    worker *workers;
+    uint64_t start;
+    int j, k;
+
+    config.hostip = "127.0.0.1";
+    config.hostport = 6379;
+    config.threads = 1;
+    config.clients = 50;
+    config.requests = 100000;
+    config.pipeline = 1;
+    config.keyspace = 100000;
+    config.datamin = config.datamax = 3;
+    config.mix[CMD_GET] = config.mix[CMD_SET] = 50;
+    config.mixtotal = 100;
+    config.seed = (unsigned long long)time(NULL);
+    parseOptions(argc, argv);
+    //a server closing the connection must be reported, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    if(config.zipf) zipfInit();
+    config.payload = zmalloc(config.datamax+1);
+    memset(config.payload, 'x', config.datamax);
+
+    workers = zcalloc(sizeof(worker)*config.threads);
+    for(j = 0; j < config.threads; j++){
+        worker *w = &workers[j];
+
+        w->rng = config.seed*2654435761ULL + j + 1;
+        w->efd = epoll_create(1024);
+        w->conns = zcalloc(sizeof(conn)*config.clients);
+        for(k = 0; k < config.clients; k++){
+            conn *c = &w->conns[k];
+            if((c->fd = connectLoopback()) == -1){
+                fprintf(stderr, "Could not connect to %s:%d: %s\n",
+                    config.hostip, config.hostport, strerror(errno));
+                exit(1);
+            }
+            c->obuf = sdsempty();
+            c->ibuf = sdsempty();
+        }
+    }
+
+    start = latencyNow();
+    for(j = 0; j < config.threads; j++){
+        pthread_create(&workers[j].tid, NULL, workerMain, &workers[j]);
+    }
+    for(j = 0; j < config.threads; j++){
+        pthread_join(workers[j].tid, NULL);
+    }
+    report(workers, latencyNow()-start);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/* Tests and throughput benchmark for bitops.c: the word and AVX2 kernels
+ * against naive byte loops. */
+
+#include "testhelp.h"
+#include "bitops.h"
+#include "zmalloc.h"
+
+#define FUZZ_ROUNDS 5000
+#define BENCH_LEN (4*1024*1024)
+#define BENCH_ROUNDS 100
+
+static long long naivePopcount(const unsigned char *p, size_t count) {
+    long long bits = 0;
+    size_t j;
+
+    for (j = 0; j < count; j++) {
+        unsigned char c = p[j];
+        while (c) {
+            bits += c & 1;
+            c >>= 1;
+        }
+    }
+    return bits;
+}
+
+static long long naiveBitpos(const unsigned char *p, size_t count, int bit) {
+    size_t j;
+
+    for (j = 0; j < count*8; j++)
+        if (((p[j>>3] >> (7-(j&7))) & 1) == bit) return j;
+    return bit ? -1 : (long long)count*8;
+}
+
+static void naiveOp(unsigned char *d, int op, sds *src, int numkeys, size_t maxlen) {
+    size_t j;
+    int k;
+
+    for (j = 0; j < maxlen; j++) {
+        unsigned char acc = j < sdslen(src[0]) ? src[0][j] : 0;
+        for (k = 1; k < numkeys; k++) {
+            unsigned char v = j < sdslen(src[k]) ? src[k][j] : 0;
+            if (op == BITOP_AND) acc &= v;
+            else if (op == BITOP_OR) acc |= v;
+            else acc ^= v;
+        }
+        d[j] = op == BITOP_NOT ? ~acc : acc;
+    }
+}
+
+/* Sparse, dense and uniform bitmaps, so that bitpos has to skip words. */
+static sds randomBitmap(unsigned long long *rng, size_t maxlen) {
+    size_t len = test_rand(rng)%maxlen, j;
+    int kind = test_rand(rng)%3;
+    sds s = sdsnewlen(NULL,len);
+
+    for (j = 0; j < len; j++) {
+        unsigned char c = test_rand(rng);
+        if (kind == 0) c = (test_rand(rng)%64) ? 0 : c;
+        else if (kind == 1) c = (test_rand(rng)%64) ? 0xff : c;
+        s[j] = c;
+    }
+    return s;
+}
+
+static void testKernels(void) {
+    unsigned long long rng = 0x2545f4914f6cdd1dULL;
+    int j, popok = 1, posok = 1, opok = 1;
+
+    for (j = 0; j < FUZZ_ROUNDS; j++) {
+        sds s = randomBitmap(&rng,300);
+        size_t off = sdslen(s) ? test_rand(&rng)%sdslen(s) : 0;
+        size_t len = sdslen(s)-off;
+
+        if (bitmapPopcount(s+off,len) != naivePopcount((unsigned char*)s+off,len))
+            popok = 0;
+        if (bitmapBitpos(s+off,len,0) != naiveBitpos((unsigned char*)s+off,len,0) ||
+            bitmapBitpos(s+off,len,1) != naiveBitpos((unsigned char*)s+off,len,1))
+            posok = 0;
+        sdsfree(s);
+    }
+    test_cond("bitmapPopcount() matches a byte loop", popok);
+    test_cond("bitmapBitpos() matches a bit loop", posok);
+
+    for (j = 0; j < FUZZ_ROUNDS; j++) {
+        int op = test_rand(&rng)%4, numkeys = op == BITOP_NOT ? 1 : 1+test_rand(&rng)%4, k;
+        sds src[4], dest;
+        unsigned char expected[300];
+        size_t maxlen = 0;
+
+        for (k = 0; k < numkeys; k++) {
+            src[k] = randomBitmap(&rng,300);
+            if (sdslen(src[k]) > maxlen) maxlen = sdslen(src[k]);
+        }
+        naiveOp(expected,op,src,numkeys,maxlen);
+        dest = bitmapOp(NULL,op,src,numkeys);
+        if (sdslen(dest) != maxlen || memcmp(dest,expected,maxlen)) opok = 0;
+        sdsfree(dest);
+        for (k = 0; k < numkeys; k++) sdsfree(src[k]);
+    }
+    test_cond("bitmapOp() matches a byte loop", opok);
+
+    {
+        sds s = sdsempty();
+        int old;
+
+        s = bitmapSetBit(s,100,1,&old);
+        test_cond("SETBIT zero extends and GETBIT reads back",
+            sdslen(s) == 13 && old == 0 && bitmapGetBit(s,100) == 1 &&
+            bitmapGetBit(s,99) == 0 && bitmapGetBit(s,1000) == 0);
+        test_cond("BITCOUNT/BITPOS ranges",
+            bitmapCount(s,0,-1) == 1 && bitmapCount(s,-1,-1) == 1 &&
+            bitmapCount(s,0,11) == 0 &&
+            bitmapPos(s,1,0,-1,0) == 100 && bitmapPos(s,1,13,-1,0) == -1 &&
+            bitmapPos(s,0,0,-1,1) == 0);
+        sdsfree(s);
+    }
+}
+
+static void benchKernels(void) {
+    unsigned long long rng = 1;
+    sds a = sdsnewlen(NULL,BENCH_LEN), b = sdsnewlen(NULL,BENCH_LEN), src[2], dest = NULL;
+    unsigned char *d = zmalloc(BENCH_LEN);
+    long long start, elapsed, sum = 0;
+    int j;
+
+    for (j = 0; j < BENCH_LEN; j++) {
+        a[j] = test_rand(&rng);
+        b[j] = test_rand(&rng);
+    }
+    src[0] = a;
+    src[1] = b;
+
+#define GBS(bytes) ((double)(bytes)*BENCH_ROUNDS/elapsed/1000)
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) sum += bitmapPopcount(a,BENCH_LEN);
+    elapsed = test_ustime()-start;
+    printf("popcount: %.2f GB/s\n", GBS(BENCH_LEN));
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) sum += naivePopcount((unsigned char*)a,BENCH_LEN);
+    elapsed = test_ustime()-start;
+    printf("popcount byte loop: %.2f GB/s\n", GBS(BENCH_LEN));
+
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) dest = bitmapOp(dest,BITOP_XOR,src,2);
+    elapsed = test_ustime()-start;
+    printf("bitop xor: %.2f GB/s\n", GBS(2*BENCH_LEN));
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) naiveOp(d,BITOP_XOR,src,2,BENCH_LEN);
+    elapsed = test_ustime()-start;
+    printf("bitop xor byte loop: %.2f GB/s (checksum %lld)\n", GBS(2*BENCH_LEN),
+        sum+d[0]+dest[0]);
+#undef GBS
+
+    sdsfree(a);
+    sdsfree(b);
+    sdsfree(dest);
+    zfree(d);
+}
+
+int main(int argc, char **argv) {
+    testKernels();
+    if (test_bench_requested(argc,argv)) benchKernels();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,195 @@
+/* Tests and dispatch benchmark for the perfect-hash command table, and
+ * checks of the case insensitive sds helpers it relies on.
+ *
+ * The benchmark compares lookupCommand() with the linear strcasecmp()
+ * scan of a plain command array. */
+
+#include <ctype.h>
+#include <strings.h>
+#include "testhelp.h"
+#include "command.h"
+#include "zmalloc.h"
+#include "latency.h"
+
+static char *names[] = {
+    "get","set","incr","append","strlen","setrange","getrange","setbit",
+    "getbit","bitcount","bitpos","bitop","pfadd","pfcount","pfmerge",
+    "lpush","zadd","del","exists","expire","ttl","persist","ping","info"
+};
+
+#define NUMNAMES ((int)(sizeof(names)/sizeof(names[0])))
+#define BENCH_LOOKUPS 20000000
+
+static int linearLookup(const char *name) {
+    int j;
+
+    for (j = 0; j < NUMNAMES; j++)
+        if (!strcasecmp(names[j],name)) return j;
+    return -1;
+}
+
+static void testLookup(void) {
+    int j, ok = 1;
+
+    for (j = 0; j < NUMNAMES; j++) {
+        struct subaruCommand *c = lookupCommandByCString(names[j]);
+        if (c == NULL || strcmp(c->name,names[j])) ok = 0;
+    }
+    test_cond("Every command is found by its name", ok);
+
+    ok = 1;
+    for (j = 0; j < NUMNAMES; j++) {
+        sds upper = sdsnew(names[j]);
+        struct subaruCommand *c;
+
+        sdstoupper(upper);
+        c = lookupCommand(upper);
+        if (c == NULL || strcmp(c->name,names[j])) ok = 0;
+        sdsfree(upper);
+    }
+    test_cond("Lookups are case insensitive", ok);
+
+    test_cond("Unknown commands are not found",
+        lookupCommandByCString("gett") == NULL &&
+        lookupCommandByCString("ge") == NULL &&
+        lookupCommandByCString("") == NULL &&
+        lookupCommandByCString("flushall") == NULL);
+
+    {
+        struct subaruCommand *get = lookupCommandByCString("get");
+        struct subaruCommand *set = lookupCommandByCString("set");
+        test_cond("Flags and arity are parsed",
+            get->arity == 2 && get->flags == (CMD_READONLY|CMD_FAST) &&
+            set->arity == -3 && set->flags == (CMD_WRITE|CMD_DENYOOM));
+    }
+}
+
+static int refcasecmp(const char *a, size_t alen, const char *b, size_t blen) {
+    size_t j, len = alen < blen ? alen : blen;
+
+    for (j = 0; j < len; j++) {
+        int c1 = tolower((unsigned char)a[j]), c2 = tolower((unsigned char)b[j]);
+        if (c1 != c2) return c1-c2;
+    }
+    return (alen > blen) - (alen < blen);
+}
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+/* Strings longer than 16 bytes, so that the block loops of sdscasecmp()
+ * and of the case folding run, with mismatches in the first block and
+ * after it. The alphabet holds the bytes around 'A'-'Z' and 'a'-'z'. */
+static void testCaseFold(void) {
+    const char *alphabet = "@AZ[`az{mM09\x80\xc1\xe1\xff";
+    unsigned long long rng = 0x2545f4914f6cdd1dULL;
+    size_t alen = strlen(alphabet);
+    int j, cmpok = 1, hashok = 1, lowerok = 1, upperok = 1;
+
+    for (j = 0; j < 20000; j++) {
+        size_t len = 17+test_rand(&rng)%50, k, pos;
+        sds a = sdsnewlen(NULL,len), b, lower, upper;
+
+        for (k = 0; k < len; k++) a[k] = alphabet[test_rand(&rng)%alen];
+        /* b is a with random case flips, then one mismatch or a length
+         * change. */
+        b = sdsnewlen(a,len);
+        for (k = 0; k < len; k++)
+            if (isalpha((unsigned char)b[k]) && test_rand(&rng)%2) b[k] ^= 0x20;
+        if (sdscasecmp(a,b) != 0 || sdscasehash(a,7) != sdscasehash(b,7)) hashok = 0;
+        switch (j%4) {
+        case 0: pos = test_rand(&rng)%16; b[pos] = alphabet[test_rand(&rng)%alen]; break;
+        case 1: pos = 16+test_rand(&rng)%(len-16); b[pos] = alphabet[test_rand(&rng)%alen]; break;
+        case 2: sdsrange(b,0,(int)(len-2)); break;
+        default: break;
+        }
+        if (sign(sdscasecmp(a,b)) != sign(refcasecmp(a,len,b,sdslen(b))) ||
+            sign(sdscasecmp(b,a)) != sign(refcasecmp(b,sdslen(b),a,len))) cmpok = 0;
+
+        lower = sdsnewlen(a,len);
+        upper = sdsnewlen(a,len);
+        sdstolower(lower);
+        sdstoupper(upper);
+        for (k = 0; k < len; k++) {
+            if (lower[k] != (char)tolower((unsigned char)a[k])) lowerok = 0;
+            if (upper[k] != (char)toupper((unsigned char)a[k])) upperok = 0;
+        }
+        sdsfree(a);
+        sdsfree(b);
+        sdsfree(lower);
+        sdsfree(upper);
+    }
+    test_cond("sdscasecmp() matches the reference past 16 bytes", cmpok);
+    test_cond("Case variants compare and hash equal", hashok);
+    test_cond("sdstolower() matches tolower() past 16 bytes", lowerok);
+    test_cond("sdstoupper() matches toupper() past 16 bytes", upperok);
+}
+
+static int dispatched = 0;
+
+static void pingProc(void *c) {
+    (void)c;
+    dispatched++;
+}
+
+static void testCall(void) {
+    struct subaruCommand *ping = lookupCommandByCString("ping");
+    sds info;
+
+    test_cond("commandSetProc() rejects unknown commands",
+        commandSetProc("nosuchcommand",pingProc) == -1);
+    commandSetProc("ping",pingProc);
+    latencySetSampleRate(1);
+    latencySetEnabled(1);
+    call(ping,NULL);
+    call(ping,NULL);
+    latencySetEnabled(0);
+    call(ping,NULL);
+    info = latencyInfoString(sdsempty());
+    test_cond("call() times the command in its histogram",
+        dispatched == 3 && strstr(info,"latency_cmd_ping:samples=2,") != NULL);
+    sdsfree(info);
+
+    latencyRecord(-1,1000);
+    test_cond("Unregistered events are ignored", 1);
+}
+
+static void benchLookup(void) {
+    sds keys[NUMNAMES];
+    long long start, elapsed;
+    long sum = 0;
+    int j;
+
+    /* Mixed case, the way clients send them. */
+    for (j = 0; j < NUMNAMES; j++) {
+        keys[j] = sdsnew(names[j]);
+        if (j & 1) sdstoupper(keys[j]);
+    }
+
+    start = test_ustime();
+    for (j = 0; j < BENCH_LOOKUPS; j++)
+        sum += lookupCommand(keys[j%NUMNAMES])->arity;
+    elapsed = test_ustime()-start;
+    printf("perfect hash lookup: %.1f ns/lookup\n",
+        (double)elapsed*1000/BENCH_LOOKUPS);
+
+    start = test_ustime();
+    for (j = 0; j < BENCH_LOOKUPS; j++)
+        sum += linearLookup(keys[j%NUMNAMES]);
+    elapsed = test_ustime()-start;
+    printf("linear strcasecmp scan: %.1f ns/lookup (checksum %ld)\n",
+        (double)elapsed*1000/BENCH_LOOKUPS, sum);
+
+    for (j = 0; j < NUMNAMES; j++) sdsfree(keys[j]);
+}
+
+int main(int argc, char **argv) {
+    commandTableInit();
+    testLookup();
+    testCaseFold();
+    testCall();
+    if (test_bench_requested(argc,argv)) benchLookup();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,145 @@
+/* Tests and benchmark for compress.c. The benchmark stores the same mixed
+ * size dataset with several thresholds, and reports the memory used by
+ * the values against the SET (compress) and GET (decompress) latency. */
+
+#include "testhelp.h"
+#include "compress.h"
+#include "zmalloc.h"
+
+#define BENCH_VALUES 20000
+
+static const char *words[] = {
+    "\"user\":", "\"id\":", "\"name\":", "\"email\":", "\"created\":",
+    "\"tags\":[", "],", "{", "}", "true,", "false,", "null,", "\"subaru\"",
+    "\"session\":", "1700000000,", "\"en-US\",", "\"active\"", " "
+};
+
+#define NUMWORDS ((int)(sizeof(words)/sizeof(words[0])))
+
+/* JSON like text, roughly 3x compressible. */
+static sds textValue(unsigned long long *rng, size_t len) {
+    sds s = sdsempty();
+
+    while (sdslen(s) < len) {
+        s = sdscat(s,(char*)words[test_rand(rng)%NUMWORDS]);
+        if (test_rand(rng)%4 == 0) s = sdscatprintf(s,"%llu,",test_rand(rng)%100000);
+    }
+    sdsrange(s,0,len-1);
+    return s;
+}
+
+static sds randomValue(unsigned long long *rng, size_t len) {
+    sds s = sdsnewlen(NULL,len);
+    size_t j;
+
+    for (j = 0; j < len; j++) s[j] = test_rand(rng);
+    return s;
+}
+
+static int roundTrip(sds val) {
+    sds orig = sdsdup(val), c, d;
+    int enc, ok;
+
+    c = compressValue(val,&enc);
+    d = decompressValue(c,enc);
+    ok = d && sdslen(d) == sdslen(orig) && !memcmp(d,orig,sdslen(orig)) &&
+         compressedValueLen(c,enc) == sdslen(orig);
+    sdsfree(orig);
+    sdsfree(c);
+    sdsfree(d);
+    return ok;
+}
+
+static void testCompress(void) {
+    unsigned long long rng = 42;
+    size_t len;
+    int ok = 1, enc;
+    sds v;
+
+    compressSetThreshold(COMPRESS_DEFAULT_THRESHOLD);
+    for (len = 1; len < 200000; len = len*3+1) {
+        if (!roundTrip(textValue(&rng,len)) ||
+            !roundTrip(randomValue(&rng,len))) ok = 0;
+    }
+    test_cond("Text and random values round trip", ok);
+
+    v = compressValue(randomValue(&rng,4096),&enc);
+    test_cond("Incompressible values stay raw", enc == VALUE_ENCODING_RAW);
+    sdsfree(v);
+
+    v = compressValue(textValue(&rng,COMPRESS_DEFAULT_THRESHOLD-1),&enc);
+    test_cond("Values below the threshold stay raw", enc == VALUE_ENCODING_RAW);
+    sdsfree(v);
+
+    v = compressValue(textValue(&rng,8192),&enc);
+    test_cond("Text values are compressed", enc == VALUE_ENCODING_LZF &&
+        sdslen(v) < 8192/2);
+    sdsrange(v,0,sdslen(v)/2);
+    test_cond("Truncated values are detected",
+        decompressValue(v,VALUE_ENCODING_LZF) == NULL);
+    sdsfree(v);
+
+    compressSetThreshold(0);
+    v = compressValue(textValue(&rng,8192),&enc);
+    test_cond("Threshold 0 disables compression", enc == VALUE_ENCODING_RAW);
+    sdsfree(v);
+}
+
+static void benchThreshold(size_t threshold, int random) {
+    static sds vals[BENCH_VALUES];
+    static int encs[BENCH_VALUES];
+    unsigned long long rng = 7;
+    size_t before, used, raw = 0;
+    long long setus = 0, getus = 0, start;
+    int j;
+
+    compressSetThreshold(threshold);
+    before = zmalloc_used_memory();
+    for (j = 0; j < BENCH_VALUES; j++) {
+        /* Log uniform sizes from 32 bytes to 32KB. */
+        size_t len = 32 << (test_rand(&rng)%11);
+        sds v;
+
+        len += test_rand(&rng)%len;
+        v = random ? randomValue(&rng,len) : textValue(&rng,len);
+        v = sdsRemoveFreeSpace(v);
+        raw += len;
+        start = test_ustime();
+        vals[j] = compressValue(v,&encs[j]);
+        setus += test_ustime()-start;
+    }
+    used = zmalloc_used_memory()-before;
+
+    for (j = 0; j < BENCH_VALUES; j++) {
+        sds d;
+
+        start = test_ustime();
+        d = decompressValue(vals[j],encs[j]);
+        getus += test_ustime()-start;
+        sdsfree(d);
+        sdsfree(vals[j]);
+    }
+    printf("%-6s %9zu %10.1f %8.2f %10.2f %10.2f\n",
+        random ? "random" : "text", threshold, (double)used/1024/1024,
+        (double)raw/used, (double)setus*1000/BENCH_VALUES,
+        (double)getus*1000/BENCH_VALUES);
+}
+
+static void benchCompress(void) {
+    static const size_t thresholds[] = {0, 64, 256, 1024, 4096, 16384};
+    int j, random;
+
+    printf("%-6s %9s %10s %8s %10s %10s\n",
+        "data", "threshold", "memory_mb", "ratio", "set_ns", "get_ns");
+    for (random = 0; random <= 1; random++)
+        for (j = 0; j < (int)(sizeof(thresholds)/sizeof(thresholds[0])); j++)
+            benchThreshold(thresholds[j],random);
+    compressSetThreshold(COMPRESS_DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char **argv) {
+    testCompress();
+    if (test_bench_requested(argc,argv)) benchCompress();
+    test_report();
+    return 0;
+}
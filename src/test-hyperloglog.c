@@ -0,0 +1,129 @@
+/* Tests and benchmark for hyperloglog.c: estimation error at growing
+ * cardinalities, sparse/dense consistency, unions, and the throughput of
+ * PFADD, PFCOUNT and PFMERGE. */
+
+#include <math.h>
+#include "testhelp.h"
+#include "hyperloglog.h"
+#include "zmalloc.h"
+
+#define BENCH_ADDS 10000000
+#define BENCH_COUNTS 20000
+
+static int addRange(sds *hll, long from, long to) {
+    char buf[32];
+    long j;
+
+    for (j = from; j < to; j++) {
+        int len = snprintf(buf,sizeof(buf),"ele:%ld",j);
+        if (hllAdd(hll,buf,len) == -1) return -1;
+    }
+    return 0;
+}
+
+static void testError(void) {
+    static const long cards[] = {10, 100, 1000, 10000, 100000, 1000000};
+    sds hll = hllCreate();
+    double maxerr = 0;
+    long prev = 0;
+    int j, ok = 1;
+
+    /* The standard error with 16384 registers is 0.81%: 4% is about five
+     * standard deviations. */
+    for (j = 0; j < (int)(sizeof(cards)/sizeof(cards[0])); j++) {
+        uint64_t est;
+        double err;
+
+        if (addRange(&hll,prev,cards[j]) == -1) ok = 0;
+        prev = cards[j];
+        est = hllCount(hll,NULL);
+        err = fabs((double)est-cards[j])/cards[j];
+        if (err > maxerr) maxerr = err;
+        printf("    card %ld: estimate %llu, error %.2f%%\n",
+            cards[j], (unsigned long long)est, err*100);
+        if (err > 0.04) ok = 0;
+    }
+    test_cond("Estimation error within 4% up to 1M elements", ok);
+    sdsfree(hll);
+}
+
+static void testEncodings(void) {
+    sds sparse = hllCreate(), dense, both[2];
+    uint64_t c1, c2;
+    int invalid;
+
+    addRange(&sparse,0,500);
+    dense = hllMergeMany(&sparse,1);
+    test_cond("Small HLLs stay sparse", sdslen(sparse) < sdslen(dense));
+    c1 = hllCount(sparse,NULL);
+    c2 = hllCount(dense,NULL);
+    test_cond("Sparse and dense encodings give the same estimate", c1 == c2);
+
+    test_cond("Adding again an element does not change a register",
+        hllAdd(&sparse,"ele:1",5) == 0 && hllAdd(&dense,"ele:1",5) == 0);
+
+    addRange(&dense,100000,200000);
+    both[0] = sparse;
+    both[1] = dense;
+    c1 = hllCountUnion(both,2,&invalid);
+    test_cond("Union of overlapping sets",
+        !invalid && fabs((double)c1-100500)/100500 < 0.04);
+
+    {
+        sds bogus = sdsnew("HYLLnot a valid hll");
+        both[1] = bogus;
+        hllCountUnion(both,2,&invalid);
+        test_cond("Invalid HLLs are detected",
+            invalid && hllAdd(&bogus,"x",1) == -1 &&
+            hllMergeMany(both,2) == NULL);
+        sdsfree(bogus);
+    }
+    sdsfree(sparse);
+    sdsfree(dense);
+}
+
+static void benchOps(void) {
+    sds hll = hllCreate(), other = hllCreate(), both[2], merged;
+    long long start, elapsed;
+    uint64_t sum = 0;
+    int j;
+
+    start = test_ustime();
+    addRange(&hll,0,BENCH_ADDS);
+    elapsed = test_ustime()-start;
+    printf("PFADD: %.2f M adds/s\n", (double)BENCH_ADDS/elapsed);
+
+    /* hllCountUnion() never uses the cache: every call decodes the
+     * registers and runs the estimator, as PFCOUNT after a change. */
+    start = test_ustime();
+    for (j = 0; j < BENCH_COUNTS; j++) {
+        int invalid;
+        sum += hllCountUnion(&hll,1,&invalid);
+    }
+    elapsed = test_ustime()-start;
+    printf("PFCOUNT dense, uncached: %.2f us/count\n",
+        (double)elapsed/BENCH_COUNTS);
+
+    addRange(&other,0,1000);
+    both[0] = hll;
+    both[1] = other;
+    start = test_ustime();
+    for (j = 0; j < BENCH_COUNTS; j++) {
+        merged = hllMergeMany(both,2);
+        sum += sdslen(merged);
+        sdsfree(merged);
+    }
+    elapsed = test_ustime()-start;
+    printf("PFMERGE dense+sparse: %.2f us/merge (checksum %llu)\n",
+        (double)elapsed/BENCH_COUNTS, (unsigned long long)sum);
+    sdsfree(hll);
+    sdsfree(other);
+}
+
+int main(int argc, char **argv) {
+    testError();
+    testEncodings();
+    if (test_bench_requested(argc,argv)) benchOps();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,342 @@
+/* Tests and loopback benchmark of the I/O engine, run against every
+ * backend the kernel supports. The benchmark is an echo server: clients
+ * send pipelined 32 byte requests and wait for them to come back, and the
+ * server side reports throughput and system calls per request. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "testhelp.h"
+#include "ioengine.h"
+#include "zmalloc.h"
+
+#define ECHO_MSGLEN 32
+#define ECHO_MAXCONNS 256
+#define ECHO_READLEN (16*1024)
+
+static int listenLoopback(int *port, int nonblock) {
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    int fd = socket(AF_INET,SOCK_STREAM|(nonblock ? SOCK_NONBLOCK : 0),0), yes = 1;
+
+    setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(yes));
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd,(struct sockaddr*)&sa,sizeof(sa)) == -1 || listen(fd,511) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    getsockname(fd,(struct sockaddr*)&sa,&salen);
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+static int connectLoopback(int port) {
+    struct sockaddr_in sa;
+    int fd = socket(AF_INET,SOCK_STREAM,0), yes = 1;
+
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd,(struct sockaddr*)&sa,sizeof(sa)) == -1) {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&yes,sizeof(yes));
+    return fd;
+}
+
+static int readFull(int fd, char *buf, size_t len) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = read(fd,buf+got,len-got);
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return 0;
+}
+
+/*-----------------------------Echo server-------------------------*/
+typedef struct echoClient {
+    int port;
+    int conns;
+    int pipeline;
+    int rounds;
+    int errors;
+} echoClient;
+
+static void *echoClientMain(void *arg) {
+    echoClient *ec = arg;
+    int fds[ECHO_MAXCONNS], j, r, k;
+    size_t batch = (size_t)ec->pipeline*ECHO_MSGLEN;
+    char *out = malloc(batch), *in = malloc(batch);
+
+    for (j = 0; j < ec->conns; j++) fds[j] = connectLoopback(ec->port);
+    for (r = 0; r < ec->rounds; r++) {
+        for (j = 0; j < ec->conns; j++) {
+            for (k = 0; k < ec->pipeline; k++)
+                snprintf(out+k*ECHO_MSGLEN,ECHO_MSGLEN+1,"%-*d",ECHO_MSGLEN,r*1000+j*10+k);
+            if (write(fds[j],out,batch) != (ssize_t)batch) ec->errors++;
+        }
+        for (j = 0; j < ec->conns; j++) {
+            for (k = 0; k < ec->pipeline; k++)
+                snprintf(out+k*ECHO_MSGLEN,ECHO_MSGLEN+1,"%-*d",ECHO_MSGLEN,r*1000+j*10+k);
+            if (readFull(fds[j],in,batch) == -1 || memcmp(in,out,batch)) ec->errors++;
+        }
+    }
+    for (j = 0; j < ec->conns; j++) close(fds[j]);
+    free(out);
+    free(in);
+    return NULL;
+}
+
+/* Echo everything received on 'conns' connections until they close.
+ * Returns the client errors; elapsed time and syscalls are returned by
+ * reference. */
+static int runEcho(int type, int conns, int pipeline, int rounds,
+                   long long *elapsed, unsigned long long *syscalls)
+{
+    ioEngine *e = ioEngineCreate(type,1024);
+    static sds bufs[1024];
+    ioCompletion events[256];
+    echoClient ec;
+    pthread_t tid;
+    int lfd, closed = 0, j;
+    long long start;
+
+    lfd = listenLoopback(&ec.port,1);
+    ec.conns = conns;
+    ec.pipeline = pipeline;
+    ec.rounds = rounds;
+    ec.errors = 0;
+    ioEngineAccept(e,lfd,NULL);
+    start = test_ustime();
+    pthread_create(&tid,NULL,echoClientMain,&ec);
+    while (closed < conns) {
+        int n = ioEngineWait(e,events,256,1000);
+
+        for (j = 0; j < n; j++) {
+            ioCompletion *c = &events[j];
+
+            if (c->op == IO_OP_ACCEPT && c->res >= 0) {
+                int yes = 1;
+                setsockopt(c->res,IPPROTO_TCP,TCP_NODELAY,&yes,sizeof(yes));
+                bufs[c->res] = sdsempty();
+                ioEngineRecv(e,c->res,&bufs[c->res],ECHO_READLEN,NULL);
+            } else if (c->op == IO_OP_RECV) {
+                sds reply;
+
+                if (c->res <= 0) {
+                    ioEngineRemove(e,c->fd);
+                    close(c->fd);
+                    sdsfree(bufs[c->fd]);
+                    closed++;
+                    continue;
+                }
+                reply = sdsnewlen(bufs[c->fd],sdslen(bufs[c->fd]));
+                sdsclear(bufs[c->fd]);
+                ioEngineWrite(e,c->fd,reply,sdslen(reply),-1,reply);
+                ioEngineRecv(e,c->fd,&bufs[c->fd],ECHO_READLEN,NULL);
+            } else if (c->op == IO_OP_WRITE) {
+                sds reply = c->udata;
+                if (c->res != (int)sdslen(reply)) ec.errors++;
+                sdsfree(reply);
+            }
+        }
+    }
+    pthread_join(tid,NULL);
+    *elapsed = test_ustime()-start;
+    *syscalls = ioEngineSyscalls(e);
+    ioEngineRemove(e,lfd);
+    ioEngineWait(e,events,256,100);
+    ioEngineRelease(e);
+    close(lfd);
+    return ec.errors;
+}
+
+/*-----------------------------Tests-------------------------*/
+static ioCompletion *waitFor(ioEngine *e, int op, int fd, ioCompletion *c) {
+    //next completion of 'op' on 'fd', others are dropped
+    int tries;
+
+    for (tries = 0; tries < 50; tries++) {
+        int n = ioEngineWait(e,c,1,100), j;
+        for (j = 0; j < n; j++)
+            if (c[j].op == op && c[j].fd == fd) return c;
+    }
+    return NULL;
+}
+
+typedef struct slowReader {
+    int fd;
+    size_t total;
+} slowReader;
+
+static void *slowReaderMain(void *arg) {
+    slowReader *sr = arg;
+    char buf[65536];
+    ssize_t n;
+
+    usleep(100000);
+    while ((n = read(sr->fd,buf,sizeof(buf))) > 0) sr->total += n;
+    return NULL;
+}
+
+static void testBackend(int type) {
+    ioEngine *e = ioEngineCreate(type,1024);
+    ioCompletion c;
+    char name[128], descr[256];
+    long long elapsed;
+    unsigned long long syscalls;
+    int sv[2], lfd, port, cfd, ok;
+    sds buf = sdsempty();
+
+    snprintf(name,sizeof(name),"%s",ioEngineName(e));
+
+    snprintf(descr,sizeof(descr),"[%s] Echo of 20 pipelined connections",name);
+    test_cond(descr,runEcho(type,20,8,50,&elapsed,&syscalls) == 0);
+
+    /* Writes at an offset, as log and snapshot writes do. */
+    {
+        FILE *fp = tmpfile();
+        int ffd = fileno(fp), done = 0, tries = 0;
+        char back[16] = {0};
+        ioCompletion evs[4];
+
+        ioEngineWrite(e,ffd,"world",5,6,NULL);
+        ioEngineWrite(e,ffd,"hello ",6,0,NULL);
+        while (done < 2 && tries++ < 50) {
+            int n = ioEngineWait(e,evs,4,100), j;
+            for (j = 0; j < n; j++) if (evs[j].op == IO_OP_WRITE) done++;
+        }
+        ok = pread(ffd,back,11,0) == 11 && !strcmp(back,"hello world");
+        snprintf(descr,sizeof(descr),"[%s] File writes at an offset",name);
+        test_cond(descr,done == 2 && ok);
+        fclose(fp);
+    }
+
+    /* Removing a descriptor cancels its pending recv, and it may be reused
+     * right away. */
+    socketpair(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0,sv);
+    ioEngineRecv(e,sv[0],&buf,1024,(void*)1);
+    ioEngineWait(e,&c,1,0);
+    ioEngineRemove(e,sv[0]);
+    ok = waitFor(e,IO_OP_RECV,sv[0],&c) && c.res == -ECANCELED && c.udata == (void*)1;
+    snprintf(descr,sizeof(descr),"[%s] ioEngineRemove() cancels a pending recv",name);
+    test_cond(descr,ok);
+    ok = ioEngineRecv(e,sv[0],&buf,1024,NULL) == 0;
+    write(sv[1],"x",1);
+    ok = ok && waitFor(e,IO_OP_RECV,sv[0],&c) && c.res == 1 && sdslen(buf) == 1;
+    snprintf(descr,sizeof(descr),"[%s] Removed descriptors can be used again",name);
+    test_cond(descr,ok);
+
+    /* A peer that goes away while nothing is pending on the descriptor must
+     * not wake the loop: about 10 waits of 10 milliseconds each. */
+    {
+        unsigned long long before = ioEngineSyscalls(e);
+        long long start;
+
+        close(sv[1]);
+        start = test_ustime();
+        while (test_ustime()-start < 100000) ioEngineWait(e,&c,1,10);
+        snprintf(descr,sizeof(descr),"[%s] Idle descriptors of closed peers do not spin",name);
+        test_cond(descr,ioEngineSyscalls(e)-before < 50);
+    }
+    ioEngineRemove(e,sv[0]);
+    close(sv[0]);
+
+    /* Writes to a full socket wait for the reader instead of failing. */
+    {
+        static char chunk[65536];
+        size_t sent = 0, total = 2*1024*1024;
+        int sndbuf = 4096, failed = 0;
+        slowReader sr;
+        pthread_t tid;
+
+        socketpair(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0,sv);
+        setsockopt(sv[0],SOL_SOCKET,SO_SNDBUF,&sndbuf,sizeof(sndbuf));
+        fcntl(sv[1],F_SETFL,0);
+        sr.fd = sv[1];
+        sr.total = 0;
+        pthread_create(&tid,NULL,slowReaderMain,&sr);
+        while (sent < total && !failed) {
+            size_t len = total-sent < sizeof(chunk) ? total-sent : sizeof(chunk);
+            ioEngineWrite(e,sv[0],chunk,len,-1,NULL);
+            if (!waitFor(e,IO_OP_WRITE,sv[0],&c) || c.res <= 0) failed = 1;
+            else sent += c.res;
+        }
+        ioEngineRemove(e,sv[0]);
+        close(sv[0]);
+        pthread_join(tid,NULL);
+        close(sv[1]);
+        snprintf(descr,sizeof(descr),"[%s] Writes to a full socket wait",name);
+        test_cond(descr,!failed && sent == total && sr.total == total);
+    }
+
+    /* A blocking listening socket must not block the event loop. */
+    lfd = listenLoopback(&port,0);
+    ioEngineAccept(e,lfd,(void*)2);
+    cfd = connectLoopback(port);
+    ok = waitFor(e,IO_OP_ACCEPT,lfd,&c) && c.res >= 0 && c.udata == (void*)2;
+    if (ok) close(c.res);
+    ok = ok && ioEngineWait(e,&c,1,50) == 0;
+    snprintf(descr,sizeof(descr),"[%s] Blocking listening sockets are drained",name);
+    test_cond(descr,ok);
+    ioEngineRemove(e,lfd);
+    ok = waitFor(e,IO_OP_ACCEPT,lfd,&c) && c.res == -ECANCELED;
+    snprintf(descr,sizeof(descr),"[%s] ioEngineRemove() cancels a pending accept",name);
+    test_cond(descr,ok);
+    close(cfd);
+    close(lfd);
+
+    sdsfree(buf);
+    ioEngineRelease(e);
+}
+
+/*-----------------------------Benchmark-------------------------*/
+static void benchBackend(int type, int conns, int pipeline, int rounds) {
+    long long elapsed;
+    unsigned long long syscalls;
+    double requests = (double)conns*pipeline*rounds;
+    ioEngine *e = ioEngineCreate(type,16);
+    const char *name = ioEngineName(e);
+    int errors;
+
+    ioEngineRelease(e);
+    errors = runEcho(type,conns,pipeline,rounds,&elapsed,&syscalls);
+    printf("%-8s conns %3d pipeline %2d: %9.0f req/s, %.3f syscalls/req%s\n",
+        name, conns, pipeline, requests*1000000/elapsed, syscalls/requests,
+        errors ? " (ERRORS)" : "");
+}
+
+int main(int argc, char **argv) {
+    int uring;
+    ioEngine *e;
+
+    signal(SIGPIPE,SIG_IGN);
+    alarm(120); /* a hang is a failure */
+    e = ioEngineCreate(IO_ENGINE_URING,16);
+    uring = e != NULL;
+    ioEngineRelease(e);
+    if (!uring) printf("io_uring not supported, testing epoll only\n");
+
+    testBackend(IO_ENGINE_EPOLL);
+    if (uring) testBackend(IO_ENGINE_URING);
+    if (test_bench_requested(argc,argv)) {
+        benchBackend(IO_ENGINE_EPOLL,50,1,2000);
+        if (uring) benchBackend(IO_ENGINE_URING,50,1,2000);
+        benchBackend(IO_ENGINE_EPOLL,50,16,1000);
+        if (uring) benchBackend(IO_ENGINE_URING,50,16,1000);
+    }
+    test_report();
+    return 0;
+}
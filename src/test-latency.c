@@ -0,0 +1,425 @@
+/* Tests for the latency histograms, and benchmark of the cost of latency
+ * tracking on allocations, command dispatch, and a request loop running
+ * real commands: RESP parsing, lookup, call() and reply building, with
+ * string, bitmap and HyperLogLog values. */
+
+#include <stdlib.h>
+#include "testhelp.h"
+#include "latency.h"
+#include "command.h"
+#include "bitops.h"
+#include "hyperloglog.h"
+#include "zmalloc.h"
+
+#define BENCH_ALLOCS 500000
+#define BENCH_LARGE_ALLOCS 50000
+#define BENCH_CALLS 2000000
+#define BENCH_REQUESTS 200000
+#define BENCH_PASSES 1
+#define BENCH_TRIALS 40
+#define DB_KEYS 1000
+
+static void testHistogram(void) {
+    latencyHistogram *h = zcalloc(sizeof(*h)), *m = zcalloc(sizeof(*h));
+    uint64_t p50, p99;
+    int j, ok = 1;
+
+    for (j = 1; j <= 100000; j++) latencyHistogramRecord(h,j);
+    p50 = latencyHistogramPercentile(h,50);
+    p99 = latencyHistogramPercentile(h,99);
+    test_cond("Percentiles are within 1/16 of the exact values",
+        p50 >= 50000 && p50 <= 50000+50000/16 &&
+        p99 >= 99000 && p99 <= 99000+99000/16 &&
+        latencyHistogramPercentile(h,100) == 100000);
+
+    for (j = 0; j < 16; j++) {
+        latencyHistogramReset(m);
+        latencyHistogramRecord(m,j);
+        if (latencyHistogramPercentile(m,50) != (uint64_t)j) ok = 0;
+    }
+    test_cond("Values below 16 are exact", ok);
+
+    latencyHistogramReset(m);
+    latencyHistogramMerge(m,h);
+    latencyHistogramMerge(m,h);
+    test_cond("Merged histograms add up",
+        m->total == 200000 && latencyHistogramPercentile(m,50) == p50);
+    zfree(h);
+    zfree(m);
+}
+
+static void testEvents(void) {
+    sds info, s;
+    void *p;
+
+    latencySetEnabled(1);
+    latencySetSampleRate(1);
+    latencySetEnabled(1);
+    p = zmalloc(ZMALLOC_LATENCY_MIN_SIZE);
+    zfree(p);
+    s = sdsMakeRoomFor(sdsempty(),100);
+    sdsfree(s);
+    latencySetEnabled(0);
+    p = zmalloc(ZMALLOC_LATENCY_MIN_SIZE);
+    zfree(p);
+    s = sdsMakeRoomFor(sdsempty(),100);
+    sdsfree(s);
+    latencySetSampleRate(LATENCY_SAMPLE_RATE);
+    info = latencyInfoString(sdsempty());
+    test_cond("Large allocations are recorded while tracking is enabled",
+        strstr(info,"latency_zmalloc:samples=1,") != NULL &&
+        strstr(info,"latency_sample_rate:16\r\n") != NULL);
+    test_cond("sdsMakeRoomFor() reallocations are recorded through the hooks",
+        strstr(info,"latency_sds_makeroom:samples=1,") != NULL);
+    sdsfree(info);
+}
+
+static void testSampling(void) {
+    int event = latencyRegisterEvent("test_sampled"), j;
+    int sleep_event = latencyRegisterEvent("test_sleep");
+    struct timespec pause = {0, 2000000};
+    uint64_t start;
+    sds info;
+
+    /* Ticks are converted to nanoseconds. */
+    latencySetSampleRate(1);
+    latencySetEnabled(1);
+    latencyStartSample(start);
+    nanosleep(&pause,NULL);
+    latencyEndSample(sleep_event,start);
+    latencySetEnabled(0);
+    info = latencyDumpJson(sdsempty());
+    {
+        const char *prefix = "\"test_sleep\":{\"samples\":1,\"p50\":";
+        char *p = strstr(info,prefix);
+        unsigned long long ns = p ? strtoull(p+strlen(prefix),NULL,10) : 0;
+        test_cond("A 2 ms pause is recorded in nanoseconds",
+            ns >= 2000000 && ns < 50000000);
+    }
+    sdsfree(info);
+
+    latencySetSampleRate(5); /* rounded up to 8 */
+    latencySetEnabled(1);
+    for (j = 0; j < 800; j++) {
+        latencyStartSample(start);
+        latencyEndSample(event,start);
+    }
+    latencySetEnabled(0);
+    latencySetSampleRate(LATENCY_SAMPLE_RATE);
+    info = latencyInfoString(sdsempty());
+    test_cond("One event out of the sample rate is timed",
+        strstr(info,"latency_test_sampled:samples=100,") != NULL);
+    sdsfree(info);
+}
+
+static void nopCommand(void *c) {
+    (*(long*)c)++;
+}
+
+/* The overhead runs are timed in thread CPU time, so that the time the
+ * process spends descheduled does not count. */
+static long long cpuUstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/* Runs the same mixed allocation loop without and with tracking. Sizes are
+ * drawn from a fixed seed, so both runs do the same work. */
+static long long benchAllocs(int enabled, int count, size_t minsize, size_t maxsize) {
+    unsigned long long rng = 1;
+    void *slots[64] = {0};
+    long long start;
+    int j;
+
+    latencySetEnabled(enabled);
+    start = cpuUstime();
+    for (j = 0; j < count; j++) {
+        int s = test_rand(&rng)%64;
+        zfree(slots[s]);
+        slots[s] = zmalloc(minsize+test_rand(&rng)%(maxsize-minsize));
+    }
+    for (j = 0; j < 64; j++) zfree(slots[j]);
+    latencySetEnabled(0);
+    return cpuUstime()-start;
+}
+
+/*-----------------------------Request loop-------------------------*/
+typedef struct benchClient {
+    int argc;
+    sds argv[8];
+    sds reply;
+} benchClient;
+
+static sds db[DB_KEYS];
+
+static sds *lookupKey(benchClient *c) {
+    return &db[atoi(c->argv[1]+4)%DB_KEYS];
+}
+
+static void addReplyBulk(benchClient *c, const char *p, size_t len) {
+    c->reply = sdscatprintf(c->reply,"$%zu\r\n",len);
+    c->reply = sdscatlen(c->reply,len,(char*)p);
+    c->reply = sdscatlen(c->reply,2,"\r\n");
+}
+
+static void addReplyLongLong(benchClient *c, long long v) {
+    c->reply = sdscatprintf(c->reply,":%lld\r\n",v);
+}
+
+static void setCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds *v = lookupKey(c);
+
+    sdsfree(*v);
+    *v = sdsdup(c->argv[2]);
+    c->reply = sdscatlen(c->reply,5,"+OK\r\n");
+}
+
+static void getCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds v = *lookupKey(c);
+
+    if (v) addReplyBulk(c,v,sdslen(v));
+    else c->reply = sdscatlen(c->reply,5,"$-1\r\n");
+}
+
+static void appendCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds *v = lookupKey(c);
+
+    if (*v == NULL || sdslen(*v) > 4096) {
+        sdsfree(*v);
+        *v = sdsempty();
+    }
+    *v = sdscatsds(*v,c->argv[2]);
+    addReplyLongLong(c,sdslen(*v));
+}
+
+static void setbitCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds *v = lookupKey(c);
+    int old;
+
+    if (*v == NULL) *v = sdsempty();
+    *v = bitmapSetBit(*v,strtoul(c->argv[2],NULL,10),atoi(c->argv[3]),&old);
+    addReplyLongLong(c,old);
+}
+
+static void bitcountCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds v = *lookupKey(c);
+
+    addReplyLongLong(c,v ? bitmapCount(v,0,-1) : 0);
+}
+
+static void pfaddCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds *v = lookupKey(c);
+    int j, updated = 0;
+
+    if (*v == NULL || !hllIsValid(*v)) {
+        sdsfree(*v);
+        *v = hllCreate();
+    }
+    for (j = 2; j < c->argc; j++)
+        updated |= hllAdd(v,c->argv[j],sdslen(c->argv[j])) == 1;
+    addReplyLongLong(c,updated);
+}
+
+static void pfcountCommand(void *privdata) {
+    benchClient *c = privdata;
+    sds v = *lookupKey(c);
+
+    addReplyLongLong(c,v && hllIsValid(v) ? (long long)hllCount(v,NULL) : 0);
+}
+
+/* Requests are spread on keys by type, so that every command finds a value
+ * of the expected type. */
+static sds buildRequests(int count) {
+    unsigned long long rng = 7;
+    sds buf = sdsempty();
+    int j;
+
+    for (j = 0; j < count; j++) {
+        int r = test_rand(&rng)%100, key = test_rand(&rng)%(DB_KEYS/4);
+        unsigned long long ele = test_rand(&rng)%100000;
+
+        if (r < 25)
+            buf = sdscatprintf(buf,"*3\r\n$3\r\nSET\r\n$8\r\nkey:%04d\r\n$16\r\nvalue:%010llu\r\n",key,ele);
+        else if (r < 55)
+            buf = sdscatprintf(buf,"*2\r\n$3\r\nGET\r\n$8\r\nkey:%04d\r\n",key);
+        else if (r < 65)
+            buf = sdscatprintf(buf,"*3\r\n$6\r\nAPPEND\r\n$8\r\nkey:%04d\r\n$8\r\n%08llu\r\n",key+DB_KEYS/4,ele);
+        else if (r < 75)
+            buf = sdscatprintf(buf,"*4\r\n$6\r\nSETBIT\r\n$8\r\nkey:%04d\r\n$5\r\n%05llu\r\n$1\r\n1\r\n",key+DB_KEYS/2,ele%65536);
+        else if (r < 80)
+            buf = sdscatprintf(buf,"*2\r\n$8\r\nBITCOUNT\r\n$8\r\nkey:%04d\r\n",key+DB_KEYS/2);
+        else if (r < 97)
+            buf = sdscatprintf(buf,"*3\r\n$5\r\nPFADD\r\n$8\r\nkey:%04d\r\n$10\r\n%010llu\r\n",key+3*DB_KEYS/4,ele);
+        else
+            buf = sdscatprintf(buf,"*2\r\n$7\r\nPFCOUNT\r\n$8\r\nkey:%04d\r\n",key+3*DB_KEYS/4);
+    }
+    return buf;
+}
+
+static char *parseBulk(char *p, sds *arg) {
+    long len = strtol(p+1,&p,10);
+
+    *arg = sdsnewlen(p+2,len);
+    return p+2+len+2;
+}
+
+/* Serves the requests the way the server does, minus the sockets: the
+ * reply buffer is flushed every 16 requests, as with pipelined clients. */
+static long long runRequests(const sds requests, int passes) {
+    benchClient c;
+    long long start = cpuUstime();
+    int pass, j, served = 0;
+
+    c.reply = sdsempty();
+    for (pass = 0; pass < passes; pass++) {
+        char *p = requests, *end = requests+sdslen(requests);
+
+        while (p < end) {
+            struct subaruCommand *cmd;
+
+            c.argc = strtol(p+1,&p,10);
+            p += 2;
+            for (j = 0; j < c.argc; j++) p = parseBulk(p,&c.argv[j]);
+            cmd = lookupCommand(c.argv[0]);
+            call(cmd,&c);
+            for (j = 0; j < c.argc; j++) sdsfree(c.argv[j]);
+            if (++served % 16 == 0) sdsclear(c.reply);
+        }
+    }
+    sdsfree(c.reply);
+    return cpuUstime()-start;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Runs 'fn' alternately without and with tracking. The overhead is the
+ * median of the paired runs, and the times the best of each mode, which
+ * filters out the noise of a shared machine. */
+static double benchOverhead(const char *what, long long (*fn)(void *), void *arg, double ops) {
+    long long best[2] = {0,0};
+    double overhead[BENCH_TRIALS];
+    int j, enabled;
+
+    for (j = 0; j < BENCH_TRIALS; j++) {
+        long long t[2];
+        int k;
+
+        /* The mode that runs first alternates, against warm up effects. */
+        for (k = 0; k <= 1; k++) {
+            enabled = k ^ (j & 1);
+            latencySetEnabled(enabled);
+            t[enabled] = fn(arg);
+            latencySetEnabled(0);
+            if (best[enabled] == 0 || t[enabled] < best[enabled]) best[enabled] = t[enabled];
+        }
+        overhead[j] = (double)(t[1]-t[0])*100/t[0];
+    }
+    qsort(overhead,BENCH_TRIALS,sizeof(double),cmpDouble);
+    printf("%s: %.1f vs %.1f ns/op, +%.1f ns, overhead %.2f%%\n", what,
+        best[0]*1000/ops, best[1]*1000/ops, (best[1]-best[0])*1000/ops,
+        overhead[BENCH_TRIALS/2]);
+    return (double)(best[1]-best[0])*1000/ops;
+}
+
+static long long benchSmallAllocs(void *arg) {
+    (void)arg;
+    return benchAllocs(latency_enabled,BENCH_ALLOCS,16,4096);
+}
+
+static long long benchLargeAllocs(void *arg) {
+    (void)arg;
+    return benchAllocs(latency_enabled,BENCH_LARGE_ALLOCS,ZMALLOC_LATENCY_MIN_SIZE,1024*1024);
+}
+
+static long long benchSameSizeReallocs(void *arg) {
+    //glibc returns at once for the same size: what is left is the cost of
+    //the latency hooks
+    long long start = cpuUstime();
+    void *p = zmalloc(ZMALLOC_LATENCY_MIN_SIZE);
+    int j;
+
+    (void)arg;
+    for (j = 0; j < BENCH_CALLS; j++) p = zrealloc(p,ZMALLOC_LATENCY_MIN_SIZE);
+    zfree(p);
+    return cpuUstime()-start;
+}
+
+static long long benchRequests(void *arg) {
+    return runRequests(arg,BENCH_PASSES);
+}
+
+static long long benchCalls(void *arg) {
+    struct subaruCommand *ping = lookupCommandByCString("ping");
+    long long start = cpuUstime(), counter = 0;
+    int j;
+
+    (void)arg;
+    commandSetProc("ping",nopCommand);
+    for (j = 0; j < BENCH_CALLS; j++) call(ping,&counter);
+    return cpuUstime()-start;
+}
+
+static void benchTracking(void) {
+    sds requests = buildRequests(BENCH_REQUESTS);
+    double reqns, pointns, largens, hookns;
+    unsigned int ticks;
+    int j;
+
+    commandSetProc("set",setCommand);
+    commandSetProc("get",getCommand);
+    commandSetProc("append",appendCommand);
+    commandSetProc("setbit",setbitCommand);
+    commandSetProc("bitcount",bitcountCommand);
+    commandSetProc("pfadd",pfaddCommand);
+    commandSetProc("pfcount",pfcountCommand);
+
+    printf("sample rate 1/%d, %s clock\n", LATENCY_SAMPLE_RATE,
+        latency_tsc ? "TSC" : "monotonic");
+    runRequests(requests,1); /* creates the values */
+    reqns = (double)runRequests(requests,1)*1000/BENCH_REQUESTS;
+    benchOverhead("requests",benchRequests,requests,(double)BENCH_REQUESTS*BENCH_PASSES);
+    benchOverhead("small allocations",benchSmallAllocs,NULL,BENCH_ALLOCS);
+    largens = benchOverhead("large allocations",benchLargeAllocs,NULL,BENCH_LARGE_ALLOCS);
+    hookns = benchOverhead("same size zrealloc()",benchSameSizeReallocs,NULL,BENCH_CALLS);
+    pointns = benchOverhead("empty command call()",benchCalls,NULL,BENCH_CALLS);
+
+    /* The noise of a shared machine is close to the overhead itself, so it
+     * is also derived from the cost of one timing point, measured above on
+     * empty commands, times the points a request goes through. */
+    latencySetEnabled(1);
+    ticks = latency_sample_tick;
+    runRequests(requests,1);
+    ticks = latency_sample_tick-ticks;
+    latencySetEnabled(0);
+    printf("requests: %.2f timing points per request at %.1f ns each, "
+        "estimated overhead %.2f%%\n",
+        (double)ticks/BENCH_REQUESTS, pointns,
+        (double)ticks/BENCH_REQUESTS*pointns*100/reqns);
+    largens = (double)benchLargeAllocs(NULL)*1000/BENCH_LARGE_ALLOCS;
+    printf("large allocations: one timing point at %.1f ns, estimated overhead %.2f%%\n",
+        hookns, hookns*100/largens);
+
+    for (j = 0; j < DB_KEYS; j++) sdsfree(db[j]);
+    sdsfree(requests);
+}
+
+int main(int argc, char **argv) {
+    commandTableInit();
+    testHistogram();
+    testEvents();
+    testSampling();
+    if (test_bench_requested(argc,argv)) benchTracking();
+    test_report();
+    return 0;
+}
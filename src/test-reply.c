@@ -0,0 +1,171 @@
+/* Tests for reply.c: block chains written through a socketpair with a
+ * small send buffer, so that writev() stops in the middle of blocks, the
+ * per thread pool and its cap, and the output buffer limits. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "testhelp.h"
+#include "reply.h"
+#include "zmalloc.h"
+
+static size_t blockSize(void) {
+    //allocation size of one block, as zmalloc accounts it
+    void *b = zmalloc(sizeof(replyBlock));
+    size_t size = zmalloc_size(b);
+
+    zfree(b);
+    return size;
+}
+
+/* Write the chain to sv[0] while draining sv[1] into 'out', a little at a
+ * time, until the chain is empty. Returns the writes that ended in the
+ * middle of a block. */
+static int drainChain(replyChain *c, int sv[2], char *out, size_t *outlen) {
+    char buf[3000];
+    int partial = 0;
+
+    while (c->bytes) {
+        ssize_t n = replyChainWrite(c,sv[0]);
+
+        if (n == -1 && errno != EAGAIN) return -1;
+        if (n > 0 && c->sentpos) partial++;
+        n = read(sv[1],buf,sizeof(buf));
+        if (n > 0) {
+            memcpy(out+*outlen,buf,n);
+            *outlen += n;
+        }
+    }
+    while (1) {
+        ssize_t n = read(sv[1],buf,sizeof(buf));
+        if (n <= 0) break;
+        memcpy(out+*outlen,buf,n);
+        *outlen += n;
+    }
+    return partial;
+}
+
+static void testWrite(void) {
+    unsigned long long rng = 0x1234567ULL;
+    size_t total = 0, outlen = 0, j, bsize = blockSize();
+    char *in = zmalloc(200000), *out = zmalloc(200000);
+    int sv[2], sndbuf = 4096, partial;
+    replyChain c;
+
+    replyPoolFlush();
+    socketpair(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0,sv);
+    setsockopt(sv[0],SOL_SOCKET,SO_SNDBUF,&sndbuf,sizeof(sndbuf));
+    replyChainInit(&c);
+
+    /* Replies of random sizes, some larger than a block. */
+    while (total < 150000) {
+        size_t len = test_rand(&rng)%40000;
+        if (total+len > 150000) len = 150000-total;
+        for (j = 0; j < len; j++) in[total+j] = test_rand(&rng);
+        replyChainAppend(&c,in+total,len);
+        total += len;
+    }
+    test_cond("Appends fill whole blocks",
+        c.bytes == total &&
+        c.nblocks == (total+REPLY_BLOCK_SIZE-1)/REPLY_BLOCK_SIZE &&
+        replyChainMemory(&c) == c.nblocks*bsize);
+
+    partial = drainChain(&c,sv,out,&outlen);
+    test_cond("Partial writes resume where they stopped",
+        partial > 0 && outlen == total && !memcmp(in,out,total));
+    test_cond("Written blocks, the tail included, go back to the pool",
+        c.head == NULL && c.tail == NULL && c.nblocks == 0 &&
+        replyChainMemory(&c) == 0 && c.sentpos == 0 &&
+        replyPoolMemory() == ((total+REPLY_BLOCK_SIZE-1)/REPLY_BLOCK_SIZE)*bsize);
+
+    /* The next replies reuse the pooled blocks. */
+    {
+        size_t pooled = replyPoolMemory(), used = zmalloc_used_memory();
+
+        replyChainAppend(&c,"+OK\r\n",5);
+        test_cond("Blocks are taken from the pool",
+            replyPoolMemory() == pooled-bsize && zmalloc_used_memory() == used);
+        outlen = 0;
+        drainChain(&c,sv,out,&outlen);
+        test_cond("Small replies are written whole",
+            outlen == 5 && !memcmp(out,"+OK\r\n",5) && replyPoolMemory() == pooled);
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    zfree(in);
+    zfree(out);
+}
+
+static void testPool(void) {
+    static char block[REPLY_BLOCK_SIZE];
+    size_t before, bsize = blockSize();
+    replyChain c;
+    int j;
+
+    replyPoolFlush();
+    before = zmalloc_used_memory();
+    replyChainInit(&c);
+    for (j = 0; j < REPLY_POOL_MAX_BLOCKS+44; j++)
+        replyChainAppend(&c,block,sizeof(block));
+    test_cond("Queued blocks are part of used_memory",
+        zmalloc_used_memory()-before == replyChainMemory(&c) &&
+        c.nblocks == REPLY_POOL_MAX_BLOCKS+44);
+    replyChainRelease(&c);
+    test_cond("The pool keeps at most REPLY_POOL_MAX_BLOCKS blocks",
+        replyPoolMemory() == REPLY_POOL_MAX_BLOCKS*bsize &&
+        zmalloc_used_memory()-before == REPLY_POOL_MAX_BLOCKS*bsize &&
+        c.nblocks == 0 && c.bytes == 0);
+    replyPoolFlush();
+    test_cond("replyPoolFlush() frees the pool",
+        replyPoolMemory() == 0 && zmalloc_used_memory() == before);
+}
+
+static void testLimits(void) {
+    static char block[REPLY_BLOCK_SIZE];
+    size_t bsize = blockSize();
+    replyChain c;
+    int j;
+
+    /* Soft limit of 2 blocks for 10 seconds, hard limit of 4 blocks. */
+    replySetLimit(REPLY_CLASS_PUBSUB,4*bsize,2*bsize,10);
+    replyChainInit(&c);
+    replyChainAppend(&c,block,sizeof(block));
+    test_cond("Under the soft limit nothing happens",
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,100) == 0);
+
+    replyChainAppend(&c,block,2*sizeof(block));
+    test_cond("Over the soft limit the client gets some time",
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,100) == 0 &&
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,109) == 0);
+    test_cond("Over the soft limit for too long the client is dropped",
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,110) == 1);
+
+    replyChainRelease(&c);
+    replyChainAppend(&c,block,sizeof(block));
+    replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,120);
+    replyChainAppend(&c,block,2*sizeof(block));
+    test_cond("Going back under the soft limit resets the timer",
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,121) == 0 &&
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,130) == 0 &&
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,131) == 1);
+
+    replyChainAppend(&c,block,sizeof(block));
+    test_cond("The hard limit drops the client at once",
+        replyChainCheckLimits(&c,REPLY_CLASS_PUBSUB,1000) == 1);
+
+    for (j = 0; j < 8; j++) replyChainAppend(&c,block,sizeof(block));
+    test_cond("Normal clients have no limit by default",
+        replyChainCheckLimits(&c,REPLY_CLASS_NORMAL,1000) == 0);
+    replyChainRelease(&c);
+    replyPoolFlush();
+}
+
+int main(void) {
+    testWrite();
+    testPool();
+    testLimits();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,175 @@
+/* Tests for rope.c: random APPEND, SETRANGE, GETRANGE and range trims are
+ * applied both to a rope and to a plain sds, and the two must always hold
+ * the same bytes. Sizes span several chunks, and trims move 'head' inside
+ * the first chunk. */
+
+#include "testhelp.h"
+#include "rope.h"
+#include "zmalloc.h"
+
+#define FUZZ_OPS 2000
+#define MAX_LEN (6*ROPE_CHUNK_SIZE)
+
+static char *randomBytes(unsigned long long *rng, size_t len) {
+    char *p = zmalloc(len ? len : 1);
+    size_t j;
+
+    for (j = 0; j < len; j++) p[j] = test_rand(rng);
+    return p;
+}
+
+/* Random offset biased toward chunk boundaries, where off by one errors
+ * hide. */
+static size_t randomOffset(unsigned long long *rng, size_t max) {
+    size_t off;
+
+    if (max == 0) return 0;
+    if (test_rand(rng)%2) {
+        off = (test_rand(rng)%(max/ROPE_CHUNK_SIZE+1))*ROPE_CHUNK_SIZE;
+        off += (long)(test_rand(rng)%5)-2;
+        if (off <= max) return off;
+    }
+    return test_rand(rng)%(max+1);
+}
+
+/* GETRANGE on a plain sds: same index rules as sdsrange(), but an empty
+ * range gives an empty string. */
+static sds refGetRange(const sds s, long start, long end) {
+    long len = sdslen(s);
+
+    if (start < 0) start += len;
+    if (end < 0) end += len;
+    if (start < 0) start = 0;
+    if (end >= len) end = len-1;
+    if (start > end || start >= len) return sdsempty();
+    return sdsnewlen(s+start,end-start+1);
+}
+
+static int ropeEquals(const rope *r, const sds s) {
+    sds all = ropeGetRange(r,0,-1);
+    int ok = ropeLen(r) == sdslen(s) && sdslen(all) == sdslen(s) &&
+             !memcmp(all,s,sdslen(s));
+
+    sdsfree(all);
+    return ok;
+}
+
+static int iovecEquals(const rope *r, const sds s, size_t offset, size_t len) {
+    //walk the range a few iovecs at a time, as a reply writer would
+    struct iovec iov[3];
+    size_t expected = offset >= sdslen(s) ? 0 :
+                      (len > sdslen(s)-offset ? sdslen(s)-offset : len);
+    size_t got = 0;
+    int n, j;
+
+    while ((n = ropeRangeIovec(r,offset+got,len-got,iov,3)) > 0) {
+        for (j = 0; j < n; j++) {
+            if (memcmp(iov[j].iov_base,s+offset+got,iov[j].iov_len)) return 0;
+            got += iov[j].iov_len;
+        }
+        if (got >= len) break;
+    }
+    return got == expected;
+}
+
+static void testFuzz(void) {
+    unsigned long long rng = 0xda3e39cb94b95bdbULL;
+    sds s = sdsnewlen(NULL,ROPE_CHUNK_SIZE+100), got, ref;
+    rope *r;
+    int j, ok = 1, rangeok = 1, iovok = 1, headok = 0;
+
+    memset(s,'x',sdslen(s));
+    r = ropeFromSds(sdsdup(s));
+    for (j = 0; j < FUZZ_OPS && ok; j++) {
+        size_t len = ropeLen(r), off, n;
+        long start, end;
+        char *p;
+
+        switch (test_rand(&rng)%5) {
+        case 0: /* APPEND */
+            if (len >= MAX_LEN) break;
+            n = test_rand(&rng)%(2*ROPE_CHUNK_SIZE);
+            p = randomBytes(&rng,n);
+            ropeAppend(r,p,n);
+            s = sdscatlen(s,n,p);
+            zfree(p);
+            break;
+        case 1: /* SETRANGE, sometimes empty or past the end */
+            off = randomOffset(&rng,len+ROPE_CHUNK_SIZE);
+            n = test_rand(&rng)%4 ? test_rand(&rng)%ROPE_CHUNK_SIZE : 0;
+            if (off+n > MAX_LEN) break;
+            p = randomBytes(&rng,n);
+            ropeSetRange(r,off,p,n);
+            if (n) {
+                if (off+n > sdslen(s)) s = sdsgrowzero(s,off+n);
+                memcpy(s+off,p,n);
+            }
+            zfree(p);
+            break;
+        case 2: /* GETRANGE, with negative indexes */
+            start = (long)randomOffset(&rng,len+10)-(long)(test_rand(&rng)%2 ? len : 0);
+            end = (long)randomOffset(&rng,len+10)-(long)(test_rand(&rng)%2 ? len : 0);
+            got = ropeGetRange(r,start,end);
+            ref = refGetRange(s,start,end);
+            if (sdslen(got) != sdslen(ref) || memcmp(got,ref,sdslen(ref))) rangeok = 0;
+            sdsfree(got);
+            sdsfree(ref);
+            break;
+        case 3: /* Iovecs of a range */
+            off = randomOffset(&rng,len+10);
+            n = test_rand(&rng)%(3*ROPE_CHUNK_SIZE);
+            if (!iovecEquals(r,s,off,n)) iovok = 0;
+            break;
+        case 4: /* Trim, keeping most of the string */
+            if (len < 2) break;
+            start = randomOffset(&rng,len/4);
+            end = len-1-randomOffset(&rng,len/4);
+            if (start > end) break;
+            ropeRange(r,start,end);
+            s = sdsrange(s,start,end);
+            if (r->head) headok = 1;
+            break;
+        }
+        if (!ropeEquals(r,s)) ok = 0;
+    }
+    test_cond("The rope always matches the plain sds", ok);
+    test_cond("ropeGetRange() matches the reference", rangeok);
+    test_cond("ropeRangeIovec() covers the range", iovok);
+    test_cond("Trims leave the first chunk at a non zero head", headok);
+    ropeFree(r);
+    sdsfree(s);
+}
+
+static void testEdges(void) {
+    rope *r = ropeCreate();
+    size_t before;
+    sds s;
+
+    ropeSetRange(r,1000,"",0);
+    test_cond("An empty SETRANGE past the end is a no-op", ropeLen(r) == 0);
+    ropeSetRange(r,ROPE_CHUNK_SIZE-1,"ab",2);
+    s = ropeGetRange(r,ROPE_CHUNK_SIZE-3,-1);
+    test_cond("SETRANGE zero fills the gap across a chunk boundary",
+        ropeLen(r) == ROPE_CHUNK_SIZE+1 && sdslen(s) == 4 &&
+        !memcmp(s,"\0\0ab",4) && r->nchunks == 2);
+    sdsfree(s);
+    ropeRange(r,ROPE_CHUNK_SIZE,-1);
+    test_cond("Trimming releases the chunks before the range",
+        r->nchunks == 1 && r->head == 0 && ropeLen(r) == 1);
+    ropeFree(r);
+
+    before = zmalloc_used_memory();
+    r = ropeCreate();
+    ropeSetRange(r,3*ROPE_CHUNK_SIZE+5,"x",1);
+    test_cond("ropeAllocSize() matches the zmalloc accounting",
+        ropeAllocSize(r) == zmalloc_used_memory()-before);
+    ropeFree(r);
+    test_cond("ropeFree() releases everything", zmalloc_used_memory() == before);
+}
+
+int main(void) {
+    testEdges();
+    testFuzz();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,241 @@
+/* Randomized tests and benchmark for the timing wheel.
+ *
+ * The benchmark loads 10M keys with mixed TTLs and simulates one hour of
+ * event loop ticks. It compares the wheel with the random sampling of keys
+ * with a TTL done by Redis' active expire cycle. For both it reports the
+ * CPU time spent expiring, and the residual keys: those already expired
+ * but still resident because no cycle reached them yet. */
+
+#include <stdint.h>
+#include "testhelp.h"
+#include "timewheel.h"
+#include "zmalloc.h"
+
+#define TEST_KEYS 20000
+#define TEST_STEPS 3000
+
+#define BENCH_KEYS 10000000
+#define BENCH_TICK 10                   /* ms, an event loop at hz 100 */
+#define BENCH_SPAN (3700*1000LL)        /* ms simulated, the TTLs and margin */
+#define BENCH_WHEEL_BUDGET 20000        /* keys expired per tick at most */
+#define BENCH_SAMPLE_KEYS 20            /* Redis ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP */
+#define BENCH_SAMPLE_TIME_PERC 25       /* of the tick, as in Redis */
+
+static long long *twhen;
+static twEntry **tentry;
+static char *talive;
+static long long tnow;
+static int early, twice;
+
+static void testExpire(void *key, void *privdata) {
+    long idx = (long)(intptr_t)key;
+
+    (void)privdata;
+    if (!talive[idx]) twice++;
+    if (twhen[idx] > tnow) early++;
+    talive[idx] = 0;
+}
+
+/* TTLs from 0 ms to past the last level, so that every level and the
+ * overflow list are used. */
+static long long randomWhen(unsigned long long *rng, long long now) {
+    return now+(long long)(test_rand(rng) & ((1ULL << (test_rand(rng)%36))-1));
+}
+
+static void testRandomized(void) {
+    unsigned long long rng = 0xdeadbeef;
+    size_t before = zmalloc_used_memory();
+    timeWheel *tw;
+    int j, step, missed = 0, memok = 1, countok = 1;
+    long alive = TEST_KEYS;
+
+    twhen = malloc(sizeof(*twhen)*TEST_KEYS);
+    tentry = malloc(sizeof(*tentry)*TEST_KEYS);
+    talive = malloc(TEST_KEYS);
+    tnow = 1700000000000LL;
+    tw = twCreate(tnow);
+    for (j = 0; j < TEST_KEYS; j++) {
+        twhen[j] = randomWhen(&rng,tnow);
+        tentry[j] = twAdd(tw,(void*)(intptr_t)j,twhen[j]);
+        talive[j] = 1;
+    }
+
+    for (step = 0; step < TEST_STEPS; step++) {
+        size_t budget = 1+test_rand(&rng)%500, n;
+
+        /* Updates and removals, as EXPIRE and PERSIST/DEL would do. */
+        for (j = 0; j < 50; j++) {
+            long idx = test_rand(&rng)%TEST_KEYS;
+            if (!talive[idx]) continue;
+            if (test_rand(&rng)%4) {
+                twhen[idx] = randomWhen(&rng,tnow);
+                twUpdate(tw,tentry[idx],twhen[idx]);
+            } else {
+                twRemove(tw,tentry[idx]);
+                talive[idx] = 0;
+            }
+        }
+
+        tnow += test_rand(&rng) & ((1ULL << (test_rand(&rng)%34))-1);
+        do {
+            n = twExpireCycle(tw,tnow,budget,testExpire,NULL);
+        } while (n == budget);
+
+        alive = 0;
+        for (j = 0; j < TEST_KEYS; j++) {
+            if (!talive[j]) continue;
+            alive++;
+            if (twhen[j] <= tnow) missed++;
+        }
+        if (tw->count != (size_t)alive) countok = 0;
+        if (twMemory(tw) != zmalloc_used_memory()-before) memok = 0;
+    }
+    test_cond("Keys expire, never before their time",
+        tw->expired > TEST_KEYS/2 && early == 0 && twice == 0);
+    test_cond("No due key is left after a complete cycle", missed == 0);
+    test_cond("The wheel counts its entries", countok);
+    test_cond("twMemory() matches zmalloc_used_memory()", memok);
+    twRelease(tw);
+    test_cond("twRelease() frees everything", zmalloc_used_memory() == before);
+    free(twhen);
+    free(tentry);
+    free(talive);
+}
+
+/*-----------------------------Benchmark-------------------------*/
+static long long *bwhen;        /* Expire time of every key. */
+static long long *bsorted;      /* Same, sorted: keys due by a time. */
+static long long bexpired;
+
+static void benchExpire(void *key, void *privdata) {
+    (void)key;
+    (void)privdata;
+    bexpired++;
+}
+
+static int cmpll(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 50% of 1 s to 1 min, 30% up to 10 min, 20% up to 1 hour. */
+static void benchGenerate(long long now) {
+    unsigned long long rng = 12345;
+    long j;
+
+    bwhen = malloc(sizeof(*bwhen)*BENCH_KEYS);
+    bsorted = malloc(sizeof(*bsorted)*BENCH_KEYS);
+    for (j = 0; j < BENCH_KEYS; j++) {
+        int kind = test_rand(&rng)%10;
+        long long ttl;
+
+        if (kind < 5) ttl = 1000+test_rand(&rng)%59000;
+        else if (kind < 8) ttl = 60000+test_rand(&rng)%540000;
+        else ttl = 600000+test_rand(&rng)%3000000;
+        bwhen[j] = bsorted[j] = now+ttl;
+    }
+    qsort(bsorted,BENCH_KEYS,sizeof(*bsorted),cmpll);
+}
+
+typedef struct benchStats {
+    long long cpu_us;
+    long long max_residual;
+    double sum_residual;
+    long ticks;
+} benchStats;
+
+static void benchResidual(benchStats *st, long long now, long *due) {
+    long long residual;
+
+    while (*due < BENCH_KEYS && bsorted[*due] <= now) (*due)++;
+    residual = *due-bexpired;
+    if (residual > st->max_residual) st->max_residual = residual;
+    st->sum_residual += residual;
+    st->ticks++;
+}
+
+static void benchReport(const char *name, benchStats *st, size_t memory) {
+    printf("%-8s expire cpu %7.1f ms (%5.2f us/tick), residual keys "
+        "avg %9.0f max %8lld, memory %7.1f MB (%.1f bytes/key)\n",
+        name, (double)st->cpu_us/1000, (double)st->cpu_us/st->ticks,
+        st->sum_residual/st->ticks, st->max_residual,
+        (double)memory/1024/1024, (double)memory/BENCH_KEYS);
+}
+
+static void benchWheel(long long start) {
+    benchStats st = {0,0,0,0};
+    long long now, t;
+    long j, due = 0;
+    size_t memory;
+    timeWheel *tw;
+
+    bexpired = 0;
+    t = test_ustime();
+    tw = twCreate(start);
+    for (j = 0; j < BENCH_KEYS; j++) twAdd(tw,(void*)(intptr_t)j,bwhen[j]);
+    t = test_ustime()-t;
+    memory = twMemory(tw);
+    printf("wheel: %d keys added in %lld ms\n", BENCH_KEYS, t/1000);
+
+    for (now = start; now <= start+BENCH_SPAN; now += BENCH_TICK) {
+        t = test_ustime();
+        twExpireCycle(tw,now,BENCH_WHEEL_BUDGET,benchExpire,NULL);
+        st.cpu_us += test_ustime()-t;
+        benchResidual(&st,now,&due);
+    }
+    benchReport("wheel",&st,memory);
+    twRelease(tw);
+}
+
+/* Keys with a TTL in an array, removed by swapping with the last one, as
+ * the expires dictionary sampled by Redis. */
+static void benchSampling(long long start) {
+    benchStats st = {0,0,0,0};
+    long long *keys = malloc(sizeof(*keys)*BENCH_KEYS), now;
+    long size = BENCH_KEYS, due = 0;
+    unsigned long long rng = 99;
+    long long limit = BENCH_TICK*1000*BENCH_SAMPLE_TIME_PERC/100;
+
+    memcpy(keys,bwhen,sizeof(*keys)*BENCH_KEYS);
+    bexpired = 0;
+    for (now = start; now <= start+BENCH_SPAN; now += BENCH_TICK) {
+        long long t = test_ustime(), iteration = 0;
+        int expired;
+
+        do {
+            int j;
+
+            expired = 0;
+            for (j = 0; j < BENCH_SAMPLE_KEYS && size; j++) {
+                long idx = test_rand(&rng)%size;
+                if (keys[idx] <= now) {
+                    keys[idx] = keys[--size];
+                    bexpired++;
+                    expired++;
+                }
+            }
+            if ((++iteration & 15) == 0 && test_ustime()-t > limit) break;
+        } while (expired > BENCH_SAMPLE_KEYS/4);
+        st.cpu_us += test_ustime()-t;
+        benchResidual(&st,now,&due);
+    }
+    benchReport("sampling",&st,sizeof(*keys)*BENCH_KEYS);
+    free(keys);
+}
+
+static void benchExpiry(void) {
+    long long start = 1700000000000LL;
+
+    benchGenerate(start);
+    benchWheel(start);
+    benchSampling(start);
+    free(bwhen);
+    free(bsorted);
+}
+
+int main(int argc, char **argv) {
+    testRandomized();
+    if (test_bench_requested(argc,argv)) benchExpiry();
+    test_report();
+    return 0;
+}
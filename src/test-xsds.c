@@ -0,0 +1,145 @@
+/* Tests and benchmark for the character class scans of xsds.c: sdstrim(),
+ * sdsspan(), sdscspan(), sdsmapchars() and sdscountbyte() against byte at
+ * a time reference versions, and checks of sdsfree_deferred(). */
+
+#include "testhelp.h"
+#include "xsds.h"
+#include "zmalloc.h"
+
+#define FUZZ_ROUNDS 20000
+#define BENCH_LEN (1024*1024)
+#define BENCH_ROUNDS 200
+
+static size_t refspan(const char *p, size_t len, const char *set, int accept) {
+    size_t j = 0;
+
+    while (j < len && (memchr(set,p[j],strlen(set)) != NULL) == accept) j++;
+    return j;
+}
+
+static sds randomString(unsigned long long *rng, const char *alphabet) {
+    size_t len = test_rand(rng)%80, alen = strlen(alphabet), j;
+    sds s = sdsnewlen(NULL,len);
+
+    /* Long runs of one byte make the prefix and suffix span whole blocks. */
+    for (j = 0; j < len; j++) {
+        if (j && test_rand(rng)%4) s[j] = s[j-1];
+        else s[j] = alphabet[test_rand(rng)%alen];
+    }
+    return s;
+}
+
+static void testScans(void) {
+    static const char *sets[] = {" \t\r\n", "x", "\x80\xff" "a", "abcdefgh01234567"};
+    const char *alphabet = " \t\r\nxyzabc01\x80\xff\x7f";
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+    int j, spanok = 1, trimok = 1;
+
+    for (j = 0; j < FUZZ_ROUNDS; j++) {
+        const char *set = sets[j%4];
+        sds s = randomString(&rng,alphabet), t;
+        size_t len = sdslen(s), head, tail;
+
+        if (sdsspan(s,set) != refspan(s,len,set,1) ||
+            sdscspan(s,set) != refspan(s,len,set,0)) spanok = 0;
+
+        head = refspan(s,len,set,1);
+        tail = 0;
+        while (tail < len-head && memchr(set,s[len-tail-1],strlen(set))) tail++;
+        t = sdsnewlen(s,len);
+        t = sdstrim(t,set);
+        if (sdslen(t) != len-head-tail || memcmp(t,s+head,sdslen(t)) ||
+            t[sdslen(t)] != '\0') trimok = 0;
+        sdsfree(s);
+        sdsfree(t);
+    }
+    test_cond("sdsspan()/sdscspan() match the reference", spanok);
+    test_cond("sdstrim() matches the reference", trimok);
+}
+
+/* sdsmapchars() as a byte loop: the first matching entry of 'from' wins. */
+static void refmapchars(char *p, size_t len, const char *from, const char *to, size_t setlen) {
+    size_t j, i;
+
+    for (j = 0; j < len; j++) {
+        for (i = 0; i < setlen; i++) {
+            if (p[j] == from[i]) {
+                p[j] = to[i];
+                break;
+            }
+        }
+    }
+}
+
+static void testMapCount(void) {
+    const char *alphabet = " \t\r\nxyzabc01\x80\xff\x7f";
+    unsigned long long rng = 0x853c49e6748fea9bULL;
+    int j, mapok = 1, countok = 1;
+
+    for (j = 0; j < FUZZ_ROUNDS; j++) {
+        sds s = randomString(&rng,alphabet), t;
+        size_t len = sdslen(s), setlen = test_rand(&rng)%6, k, count = 0;
+        char from[8], to[8], c = alphabet[test_rand(&rng)%strlen(alphabet)];
+
+        /* Duplicates in 'from' are likely with so few distinct bytes. */
+        for (k = 0; k < setlen; k++) {
+            from[k] = alphabet[test_rand(&rng)%strlen(alphabet)];
+            to[k] = alphabet[test_rand(&rng)%strlen(alphabet)];
+        }
+        t = sdsnewlen(s,len);
+        sdsmapchars(s,from,to,setlen);
+        refmapchars(t,len,from,to,setlen);
+        if (memcmp(s,t,len)) mapok = 0;
+
+        for (k = 0; k < len; k++) count += (s[k] == c);
+        if (sdscountbyte(s,c) != count) countok = 0;
+        sdsfree(s);
+        sdsfree(t);
+    }
+    test_cond("sdsmapchars() matches the reference", mapok);
+    test_cond("sdscountbyte() matches the reference", countok);
+}
+
+static void benchScans(void) {
+    sds s = sdsnewlen(NULL,BENCH_LEN);
+    long long start, elapsed;
+    size_t sum = 0;
+    int j;
+
+    memset(s,' ',BENCH_LEN);
+    s[BENCH_LEN-1] = 'x';
+
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) sum += sdsspan(s," \t\r\n");
+    elapsed = test_ustime()-start;
+    printf("sdsspan: %.2f GB/s\n",
+        (double)BENCH_LEN*BENCH_ROUNDS/elapsed/1000);
+
+    start = test_ustime();
+    for (j = 0; j < BENCH_ROUNDS; j++) sum += refspan(s,BENCH_LEN," \t\r\n",1);
+    elapsed = test_ustime()-start;
+    printf("byte loop: %.2f GB/s (checksum %zu)\n",
+        (double)BENCH_LEN*BENCH_ROUNDS/elapsed/1000, sum);
+    sdsfree(s);
+}
+
+static void testDeferredFree(void) {
+    sds s = sdsnew("retired string");
+    int j;
+
+    sdsfree_deferred(s);
+    test_cond("sdsfree_deferred() parks the whole allocation",
+        zmalloc_deferred_memory() == zmalloc_size(SDSGETHDR(s)));
+    for (j = 0; j < 4; j++) zmalloc_epoch_reclaim();
+    test_cond("sdsfree_deferred() memory is reclaimed",
+        zmalloc_deferred_memory() == 0);
+}
+
+int main(int argc, char **argv) {
+    testScans();
+    testMapCount();
+    testDeferredFree();
+    if (test_bench_requested(argc,argv)) benchScans();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Tests for zmalloc.c. This program links zmalloc.o alone, which checks
+ * that the allocator keeps no dependency on the other modules. */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "testhelp.h"
+#include "zmalloc.h"
+
+static int hook_calls[2], hook_starts;
+
+static unsigned long long countingStart(void) {
+    /* Every other sample is skipped, as a sampling start hook does. */
+    return ++hook_starts % 2 ? 42 : 0;
+}
+
+static void countingEnd(int event, unsigned long long start) {
+    if (start == 42) hook_calls[event]++;
+}
+
+/*-----------------------------Deferred reclamation-------------------------*/
+static int reader_state;    /* 0 start, 1 inside, 2 asked to leave, 3 left. */
+
+static void *readerMain(void *arg) {
+    (void)arg;
+    zmalloc_epoch_enter();
+    __atomic_store_n(&reader_state,1,__ATOMIC_RELEASE);
+    while (__atomic_load_n(&reader_state,__ATOMIC_ACQUIRE) != 2) usleep(1000);
+    zmalloc_epoch_leave();
+    __atomic_store_n(&reader_state,3,__ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *retireAndExitMain(void *arg) {
+    //retire pointers and exit without reclaiming them: they are orphaned
+    int j;
+
+    for (j = 0; j < 100; j++) zfree_deferred(zmalloc(((size_t)arg)));
+    return NULL;
+}
+
+/* The epoch advances by one step per reclaim at most, and a pointer is
+ * freed two steps after it was retired. */
+static void reclaimAll(void) {
+    int j;
+
+    for (j = 0; j < 4; j++) zmalloc_epoch_reclaim();
+}
+
+static void testEpoch(void) {
+    size_t before;
+    pthread_t tid;
+    void *p;
+
+    zmalloc_epoch_reclaim(); /* registers the thread record */
+    before = zmalloc_used_memory();
+    p = zmalloc(1000);
+    zfree_deferred(p);
+    test_cond("Deferred frees are accounted",
+        zmalloc_deferred_memory() == zmalloc_size(p));
+    reclaimAll();
+    test_cond("Deferred frees are reclaimed without readers",
+        zmalloc_deferred_memory() == 0 && zmalloc_used_memory() == before);
+
+    /* A reader inside a critical section blocks reclamation. */
+    pthread_create(&tid,NULL,readerMain,NULL);
+    while (__atomic_load_n(&reader_state,__ATOMIC_ACQUIRE) != 1) usleep(1000);
+    zfree_deferred(zmalloc(1000));
+    reclaimAll();
+    test_cond("An active reader blocks reclamation",
+        zmalloc_deferred_memory() > 0);
+    __atomic_store_n(&reader_state,2,__ATOMIC_RELEASE);
+    while (__atomic_load_n(&reader_state,__ATOMIC_ACQUIRE) != 3) usleep(1000);
+    reclaimAll();
+    test_cond("Memory is freed once the reader left",
+        zmalloc_deferred_memory() == 0);
+    pthread_join(tid,NULL);
+
+    /* Nested sections: only the outermost leave ends the section. */
+    zmalloc_epoch_enter();
+    zmalloc_epoch_enter();
+    zfree_deferred(zmalloc(1000));
+    zmalloc_epoch_leave();
+    reclaimAll();
+    test_cond("A nested leave keeps the section open",
+        zmalloc_deferred_memory() > 0);
+    zmalloc_epoch_leave();
+    reclaimAll();
+    test_cond("The outermost leave closes the section",
+        zmalloc_deferred_memory() == 0);
+
+    /* Batches of an exited thread go to the orphan list. */
+    pthread_create(&tid,NULL,retireAndExitMain,(void*)(size_t)1000);
+    pthread_join(tid,NULL);
+    test_cond("Batches of an exited thread are pending",
+        zmalloc_deferred_memory() > 0);
+    reclaimAll();
+    test_cond("Orphaned batches are reclaimed by another thread",
+        zmalloc_deferred_memory() == 0);
+}
+
+int main(void) {
+    size_t before = zmalloc_used_memory();
+    void *small, *large;
+
+    small = zmalloc(100);
+    test_cond("Allocations are accounted",
+        zmalloc_used_memory()-before == zmalloc_size(small));
+    small = zrealloc(small,1000);
+    test_cond("Reallocations are accounted",
+        zmalloc_used_memory()-before == zmalloc_size(small));
+    zfree(small);
+    test_cond("Frees are accounted", zmalloc_used_memory() == before);
+
+    zmalloc_set_latency_hooks(countingStart,countingEnd);
+    small = zmalloc(ZMALLOC_LATENCY_MIN_SIZE-1);
+    large = zmalloc(ZMALLOC_LATENCY_MIN_SIZE);
+    large = zrealloc(large,ZMALLOC_LATENCY_MIN_SIZE*2);
+    large = zrealloc(large,ZMALLOC_LATENCY_MIN_SIZE*3);
+    test_cond("The latency hooks see only large allocations",
+        hook_starts == 3 && hook_calls[ZMALLOC_EVENT_MALLOC] == 1 &&
+        hook_calls[ZMALLOC_EVENT_REALLOC] == 1);
+    zmalloc_set_latency_hooks(NULL,NULL);
+    zfree(zcalloc(ZMALLOC_LATENCY_MIN_SIZE));
+    test_cond("Removing the hooks stops timing", hook_starts == 3);
+    zfree(small);
+    zfree(large);
+
+    testEpoch();
+    test_report();
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* Minimal test and benchmark helpers shared by the test-*.c programs.
+ *
+ * A test program runs its correctness checks, then its benchmarks when
+ * started with --bench. test_report() exits with 1 if a check failed. */
+
+#ifndef __TESTHELP_H
+#define __TESTHELP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int __failed_tests = 0;
+static int __test_num = 0;
+
+#define test_cond(descr,_c) do { \
+    __test_num++; printf("%d - %s: ", __test_num, descr); \
+    if(_c) printf("PASSED\n"); else {printf("FAILED\n"); __failed_tests++;} \
+} while(0)
+
+#define test_report() do { \
+    printf("%d tests, %d passed, %d failed\n", __test_num, \
+                    __test_num-__failed_tests, __failed_tests); \
+    if (__failed_tests) { \
+        printf("=== WARNING === We have failed tests here...\n"); \
+        exit(1); \
+    } \
+} while(0)
+
+static inline int test_bench_requested(int argc, char **argv) {
+    int j;
+
+    for (j = 1; j < argc; j++)
+        if (!strcmp(argv[j],"--bench")) return 1;
+    return 0;
+}
+
+static inline long long test_ustime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/* Deterministic xorshift generator, so failures are reproducible. */
+static inline unsigned long long test_rand(unsigned long long *state) {
+    unsigned long long x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+#endif /* __TESTHELP_H */
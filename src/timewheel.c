@@ -0,0 +1,179 @@
+#include <limits.h>
+#include <string.h>
+#include "timewheel.h"
+#include "zmalloc.h"
+
+#define TW_MASK (TW_SLOTS-1)
+
+/*-----------------------------Internals-------------------------*/
+static void twLink(twEntry **head, twEntry *e){
+    e->next = *head;
+    e->pprev = head;
+    if(*head) (*head)->pprev = &e->next;
+    *head = e;
+}
+
+static void twUnlink(twEntry *e){
+    *e->pprev = e->next;
+    if(e->next) e->next->pprev = e->pprev;
+}
+
+static void twPlace(timeWheel *tw, twEntry *e){
+    //the entry goes to the lowest level whose window, relative to the
+    //current time, contains it: level l is used when 'when' and 'current'
+    //only differ in the bits covered by levels 0..l
+    long long when = e->when < tw->current ? tw->current : e->when;
+    int l;
+
+    for(l = 0; l < TW_LEVELS; l++){
+        int shift = TW_SLOT_BITS*(l+1);
+        if((when >> shift) == (tw->current >> shift)){
+            twLink(&tw->slots[l][(when >> (TW_SLOT_BITS*l)) & TW_MASK], e);
+            return;
+        }
+    }
+    twLink(&tw->overflow, e);
+}
+
+static void twCascadeList(timeWheel *tw, twEntry **head){
+    //place again every entry of the list, relative to the current time
+    twEntry *e = *head, *next;
+
+    *head = NULL;
+    while(e){
+        next = e->next;
+        twPlace(tw, e);
+        e = next;
+    }
+}
+
+static void twCascade(timeWheel *tw){
+    //at the start of every level 0 window, move down the entries of the
+    //upper slots that the current time just entered
+    int l;
+
+    if(tw->cascaded == tw->current) return;
+    tw->cascaded = tw->current;
+    if(tw->current & TW_MASK) return;
+    for(l = 1; l < TW_LEVELS; l++){
+        int idx = (tw->current >> (TW_SLOT_BITS*l)) & TW_MASK;
+        twCascadeList(tw, &tw->slots[l][idx]);
+        if(idx) return;
+    }
+    twCascadeList(tw, &tw->overflow);
+}
+
+static long long twNextTick(const timeWheel *tw){
+    //first millisecond after the current one with something to do: a level
+    //0 slot to expire, or the start of a window whose upper slot must be
+    //cascaded. Empty windows are skipped, so idle periods cost nothing.
+    int l, j;
+
+    for(j = (tw->current & TW_MASK)+1; j < TW_SLOTS; j++){
+        if(tw->slots[0][j]) return (tw->current & ~(long long)TW_MASK) | j;
+    }
+    for(l = 1; l < TW_LEVELS; l++){
+        int shift = TW_SLOT_BITS*l;
+        long long base = tw->current >> shift;
+
+        for(j = (base & TW_MASK)+1; j < TW_SLOTS; j++){
+            if(tw->slots[l][j]) return ((base & ~(long long)TW_MASK) | j) << shift;
+        }
+    }
+    if(tw->overflow){
+        return ((tw->current >> (TW_SLOT_BITS*TW_LEVELS))+1) << (TW_SLOT_BITS*TW_LEVELS);
+    }
+    return LLONG_MAX;
+}
+
+/*-----------------------------APIs-------------------------*/
+timeWheel *twCreate(long long now){
+    timeWheel *tw = zcalloc(sizeof(*tw));
+
+    tw->current = now;
+    tw->cascaded = -1;
+    return tw;
+}
+
+void twRelease(timeWheel *tw){
+    //free the entries, but not the keys they reference
+    int l, j;
+
+    for(l = 0; l < TW_LEVELS; l++){
+        for(j = 0; j < TW_SLOTS; j++){
+            while(tw->slots[l][j]){
+                twEntry *e = tw->slots[l][j];
+                tw->slots[l][j] = e->next;
+                zfree(e);
+            }
+        }
+    }
+    while(tw->overflow){
+        twEntry *e = tw->overflow;
+        tw->overflow = e->next;
+        zfree(e);
+    }
+    zfree(tw);
+}
+
+twEntry *twAdd(timeWheel *tw, void *key, long long when){
+    //the returned entry is kept by the key, to update or remove its TTL
+    twEntry *e = zmalloc(sizeof(*e));
+
+    e->key = key;
+    e->when = when;
+    twPlace(tw, e);
+    tw->count++;
+    tw->memory += zmalloc_size(e);
+    return e;
+}
+
+void twUpdate(timeWheel *tw, twEntry *e, long long when){
+    twUnlink(e);
+    e->when = when;
+    twPlace(tw, e);
+}
+
+void twRemove(timeWheel *tw, twEntry *e){
+    //PERSIST, DEL or lazy expiry on access: the entry is freed
+    twUnlink(e);
+    tw->count--;
+    tw->memory -= zmalloc_size(e);
+    zfree(e);
+}
+
+size_t twExpireCycle(timeWheel *tw, long long now, size_t maxkeys, twExpireProc *proc, void *privdata){
+    //expire at most maxkeys keys due at 'now', calling proc for each one
+    //after its entry is freed. When the budget is exhausted the wheel stops
+    //in the middle of the slot and the next call resumes from there.
+    size_t expired = 0;
+
+    while(tw->current <= now){
+        twEntry **slot;
+        long long next;
+
+        twCascade(tw);
+        slot = &tw->slots[0][tw->current & TW_MASK];
+        while(*slot && expired < maxkeys){
+            twEntry *e = *slot;
+            void *key = e->key;
+
+            twUnlink(e);
+            tw->count--;
+            tw->memory -= zmalloc_size(e);
+            zfree(e);
+            proc(key, privdata);
+            expired++;
+        }
+        if(*slot) break;
+        next = twNextTick(tw);
+        tw->current = next > now ? now+1 : next;
+    }
+    tw->expired += expired;
+    return expired;
+}
+
+size_t twMemory(const timeWheel *tw){
+    //bytes allocated through zmalloc by the wheel and its entries
+    return zmalloc_size((void *)tw) + tw->memory;
+}
@@ -0,0 +1,46 @@
+#ifndef __TIMEWHEEL_H
+#define __TIMEWHEEL_H
+
+#include <stddef.h>
+
+/* Hierarchical timing wheel tracking the keys with a TTL, one per worker
+ * thread or shard (it is not thread safe). Level 0 has one slot per
+ * millisecond of the current 256 ms window, every upper level has slots
+ * 256 times wider, and the entries of an upper slot are moved down when the
+ * wheel reaches it. Times beyond the four levels (about 49 days) wait in an
+ * overflow list. Expiring a due key is O(1), and nothing is scanned to find
+ * the keys to expire. */
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 8
+#define TW_SLOTS (1<<TW_SLOT_BITS)
+
+typedef struct twEntry {
+    struct twEntry *next;
+    struct twEntry **pprev; /* Previous 'next' field, or the slot head. */
+    long long when;         /* Unix time in milliseconds. */
+    void *key;
+} twEntry;
+
+typedef void twExpireProc(void *key, void *privdata);
+
+typedef struct timeWheel {
+    twEntry *slots[TW_LEVELS][TW_SLOTS];
+    twEntry *overflow;
+    long long current;      /* Next millisecond to process. */
+    long long cascaded;     /* Last millisecond whose cascade was done. */
+    size_t count;
+    size_t memory;          /* zmalloc_size() of the entries. */
+    unsigned long long expired;
+} timeWheel;
+
+timeWheel *twCreate(long long now);
+void twRelease(timeWheel *tw);
+twEntry *twAdd(timeWheel *tw, void *key, long long when);
+void twUpdate(timeWheel *tw, twEntry *e, long long when);
+void twRemove(timeWheel *tw, twEntry *e);
+size_t twExpireCycle(timeWheel *tw, long long now, size_t maxkeys, twExpireProc *proc, void *privdata);
+size_t twMemory(const timeWheel *tw);
+
+#define twEntryExpired(e,now) ((e)->when <= (now))
+
+#endif /* __TIMEWHEEL_H */
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <string.h>
+#include "xlzf.h"
+
+/* Stream format, a sequence of:
+ *
+ * 000LLLLL <L+1 bytes>             literal run of 1 to 32 bytes
+ * LLLooooo oooooooo                back reference, L in [1,6]
+ * 111ooooo LLLLLLLL oooooooo       back reference, L is 7 + next byte
+ *
+ * A back reference copies L+2 bytes starting o+1 bytes before the current
+ * output position, possibly overlapping the bytes it produces. */
+
+#define XLZF_HLOG 13
+#define XLZF_HSIZE (1<<XLZF_HLOG)
+#define XLZF_MAX_LIT (1<<5)
+#define XLZF_MAX_OFF (1<<13)
+#define XLZF_MAX_REF ((1<<8)+(1<<3))
+
+static inline uint32_t xlzfHash(const uint8_t *p){
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761U) >> (32-XLZF_HLOG);
+}
+
+static uint8_t *xlzfLiterals(uint8_t *op, uint8_t *out_end, const uint8_t *lit, size_t len){
+    //emit len literal bytes as runs of at most XLZF_MAX_LIT, NULL on overflow
+    while(len){
+        size_t n = len > XLZF_MAX_LIT ? XLZF_MAX_LIT : len;
+
+        if((size_t)(out_end-op) < n+1) return NULL;
+        *op++ = n-1;
+        memcpy(op, lit, n);
+        op += n;
+        lit += n;
+        len -= n;
+    }
+    return op;
+}
+
+size_t xlzf_compress(const void *in, size_t in_len, void *out, size_t out_len){
+    const uint8_t *ip = in;
+    uint8_t *op = out, *out_end = op+out_len;
+    uint32_t htab[XLZF_HSIZE];  //last position+1 of each 3 bytes hash
+    size_t i = 0, anchor = 0;
+
+    memset(htab, 0, sizeof(htab));
+    while(i+3 <= in_len){
+        uint32_t h = xlzfHash(ip+i);
+        size_t ref = htab[h];
+
+        htab[h] = i+1;
+        if(ref && i-(ref-1) <= XLZF_MAX_OFF && memcmp(ip+ref-1, ip+i, 3) == 0){
+            size_t off = i-ref, len = 3, maxlen = in_len-i;
+
+            ref--;
+            if(maxlen > XLZF_MAX_REF) maxlen = XLZF_MAX_REF;
+            while(len < maxlen && ip[ref+len] == ip[i+len]) len++;
+
+            op = xlzfLiterals(op, out_end, ip+anchor, i-anchor);
+            if(op == NULL || out_end-op < 3) return 0;
+            len -= 2;
+            if(len < 7){
+                *op++ = (off >> 8) | (len << 5);
+            }
+            else{
+                *op++ = (off >> 8) | (7 << 5);
+                *op++ = len-7;
+            }
+            *op++ = off & 0xff;
+            len += 2;
+
+            //index the last position of the match so that runs chain
+            if(i+len+2 < in_len){
+                htab[xlzfHash(ip+i+len-1)] = i+len;
+            }
+            i += len;
+            anchor = i;
+        }
+        else{
+            i++;
+        }
+    }
+    op = xlzfLiterals(op, out_end, ip+anchor, in_len-anchor);
+    if(op == NULL) return 0;
+    return op-(uint8_t *)out;
+}
+
+size_t xlzf_decompress(const void *in, size_t in_len, void *out, size_t out_len){
+    const uint8_t *ip = in, *in_end = ip+in_len;
+    uint8_t *op = out, *out_end = op+out_len;
+
+    while(ip < in_end){
+        unsigned int ctrl = *ip++;
+
+        if(ctrl < (1 << 5)){
+            ctrl++;
+            if((size_t)(out_end-op) < ctrl || (size_t)(in_end-ip) < ctrl) return 0;
+            memcpy(op, ip, ctrl);
+            op += ctrl;
+            ip += ctrl;
+        }
+        else{
+            size_t len = ctrl >> 5, off = (ctrl & 0x1f) << 8;
+            uint8_t *ref;
+
+            if(len == 7){
+                if(ip >= in_end) return 0;
+                len += *ip++;
+            }
+            if(ip >= in_end) return 0;
+            off += *ip++;
+            len += 2;
+            if((size_t)(op-(uint8_t *)out) < off+1 || (size_t)(out_end-op) < len) return 0;
+            ref = op-off-1;
+            if(off+1 >= len){
+                memcpy(op, ref, len);
+                op += len;
+            }
+            else{
+                //overlapping copy, repeats the last off+1 bytes
+                while(len--) *op++ = *ref++;
+            }
+        }
+    }
+    return op-(uint8_t *)out;
+}
@@ -0,0 +1,13 @@
+#ifndef __XLZF_H
+#define __XLZF_H
+
+#include <stddef.h>
+
+/* A small LZ77 block codec using the LZF stream format: fast to compress
+ * and very fast to decompress, at a moderate ratio. Both functions return
+ * the number of bytes written to 'out', or 0 if 'out_len' is too small or
+ * (decompressing) if the input is corrupted. */
+size_t xlzf_compress(const void *in, size_t in_len, void *out, size_t out_len);
+size_t xlzf_decompress(const void *in, size_t in_len, void *out, size_t out_len);
+
+#endif /* __XLZF_H */
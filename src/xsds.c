@@ -3,9 +3,29 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define SDS_CHARCLASS_SSSE3 1
+#endif
 #include "xsds.h"
 #include "zmalloc.h"
 
+/* Latency hooks for sdsMakeRoomFor() reallocations, installed by the
+ * latency module so that sds does not depend on it. The start hook
+ * returns a timestamp, or 0 to skip the sample. */
+static unsigned long long (*sdsLatencyStart)(void) = NULL;
+static void (*sdsLatencyEnd)(unsigned long long start) = NULL;
+
+void sdsSetLatencyHooks(unsigned long long (*start)(void), void (*end)(unsigned long long start)){
+    //the end hook is installed first and removed last, as in zmalloc
+    if(start) sdsLatencyEnd = end;
+    sdsLatencyStart = start;
+    if(!start) sdsLatencyEnd = end;
+}
+
 /*-----------------------------APIs-------------------------*/
 sds sdsnewlen(const void *init, size_t initlen){
     //return the sds with initlen and init as initial buf
@@ -58,6 +78,14 @@ void sdsfree(sds str){
     return;
 }
 
+void sdsfree_deferred(sds str){
+    //Free the given sds once no lock-free reader can still access it,
+    //see zfree_deferred() in zmalloc.c
+    if(str){
+        zfree_deferred(str-sizeof(sdshdr));
+    }
+}
+
 void sdsupdatelen(sds s){
     //update the given sds's corresponding sdshdr's free and len
     sdshdr *sh = SDSGETHDR(s);
@@ -79,6 +107,9 @@ sds sdsMakeRoomFor(sds str, size_t addlen){
      //Enlarge the storage of str->buf
     sdshdr *sh = SDSGETHDR(str), *newsh;
     unsigned int olen, nlen;
+    unsigned long long (*start)(void) = sdsLatencyStart;
+    void (*end)(unsigned long long) = sdsLatencyEnd;
+    unsigned long long latency;
     //Prealloc space is enough, no need for enlarge
     if(addlen <= sh->free){
         return str;
@@ -94,7 +125,9 @@ sds sdsMakeRoomFor(sds str, size_t addlen){
         nlen += SDS_MAX_PREALLOC;
     }
 
+    latency = start ? start() : 0;
     newsh = zrealloc(sh, sizeof(sdshdr)+nlen+1);
+    if(latency && end) end(latency);
     if(newsh == NULL){
         return NULL;
     }
@@ -134,13 +167,15 @@ void sdsIncrLen(sds str, int incr){
 sds sdsgrowzero(sds str, size_t nlen){
     /*expand the sds to given length with '\0'*/
     sdshdr *sh = SDSGETHDR(str);
-    int olen = sh->len, totlen;
+    size_t olen = sh->len, totlen;
     //No need for enlarge if old length >= new length
     if(olen >= nlen){
         return str;
     }
     str = sdsMakeRoomFor(str, nlen-olen);
     if(str == NULL) return NULL;
+    //the header may have moved
+    sh = SDSGETHDR(str);
     memset(str+olen, 0, nlen-olen+1);
     //put '\0' in places with no content
     totlen = sh->len + sh->free;
@@ -234,33 +269,216 @@ sds sdsrange(sds str, int start, int end){
     return str;
 }
 
-sds sdstrim(sds str, const char *cset){
-    char *pstart, *pend;
-    sdshdr *sh = SDSGETHDR(str);
-    int nlen, totlen = sh->len+sh->free;
+/*-------------------------Character classes-----------------------*/
+/* A set of bytes as a 256 bit bitmap, built once per call so that scanning
+ * costs one lookup per byte whatever the size of the set. On x86 the set is
+ * also stored as two nibble tables, testing 16 bytes per step with SSSE3
+ * when the CPU has it: the low nibble of a byte selects a row, whose bit
+ * number (high nibble & 7) says if the byte is in the set; one table covers
+ * bytes < 128, the other bytes >= 128. */
+typedef struct sdscharclass{
+    unsigned char bits[32];
+#if defined(SDS_CHARCLASS_SSSE3)
+    unsigned char low[16];
+    unsigned char high[16];
+#endif
+} sdscharclass;
+
+#if defined(SDS_CHARCLASS_SSSE3)
+#if defined(__SSSE3__)
+#define sdscharclassssse3() 1
+#else
+static int sdscharclassssse3(void){
+    //the SSSE3 kernels are compiled in anyway, use them if the CPU can
+    static int ssse3 = -1;
+
+    if(ssse3 == -1){
+        __builtin_cpu_init();
+        ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    }
+    return ssse3;
+}
+#endif
+#endif
+
+static void sdscharclassinit(sdscharclass *cc, const char *set, size_t setlen){
+    size_t j;
+
+    memset(cc, 0, sizeof(*cc));
+    for(j = 0; j < setlen; j++){
+        unsigned char c = set[j];
+        cc->bits[c>>3] |= 1<<(c&7);
+#if defined(SDS_CHARCLASS_SSSE3)
+        if(c < 128) cc->low[c&15] |= 1<<(c>>4);
+        else cc->high[c&15] |= 1<<((c>>4)-8);
+#endif
+    }
+}
+
+static inline int sdscharclasstest(const sdscharclass *cc, unsigned char c){
+    return (cc->bits[c>>3] >> (c&7)) & 1;
+}
+
+#if defined(SDS_CHARCLASS_SSSE3)
+__attribute__((target("ssse3")))
+static inline int sdscharclassmatch16(__m128i low, __m128i high, __m128i v){
+    //returns a 16 bit mask, bit j set if byte j of v is in the set
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i bitpos = _mm_setr_epi8(1,2,4,8,16,32,64,-128,
+                                         1,2,4,8,16,32,64,-128);
+    __m128i lo = _mm_and_si128(v, nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    __m128i ishigh = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    __m128i row = _mm_or_si128(
+        _mm_and_si128(ishigh, _mm_shuffle_epi8(high, lo)),
+        _mm_andnot_si128(ishigh, _mm_shuffle_epi8(low, lo)));
+    __m128i bit = _mm_shuffle_epi8(bitpos, hi);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+}
 
-    pstart = sh->buf;
-    pend = sh->buf+sh->len-1;
-    while((pstart <= (sh->buf+sh->len-1)) && (strchr(cset, *pstart))){
-        pstart++;
+__attribute__((target("ssse3")))
+static size_t sdscharclassfwd16(const sdscharclass *cc, const char *p, size_t len, int accept){
+    //scan the whole 16 byte blocks of p: returns the position of the first
+    //byte whose membership is not 'accept', or the size of the blocks
+    __m128i low = _mm_loadu_si128((const __m128i *)cc->low);
+    __m128i high = _mm_loadu_si128((const __m128i *)cc->high);
+    size_t j;
+
+    for(j = 0; j+16 <= len; j += 16){
+        int m = sdscharclassmatch16(low, high, _mm_loadu_si128((const __m128i *)(p+j)));
+        int stop = (accept ? ~m : m) & 0xFFFF;
+        if(stop){
+            return j+__builtin_ctz(stop);
+        }
     }
-    while((pend >= sh->buf) && (strchr(cset, *pend))){
-        pend--;
+    return j;
+}
+
+__attribute__((target("ssse3")))
+static size_t sdscharclassbwd16(const sdscharclass *cc, const char *p, size_t len, int accept){
+    //same as sdscharclassfwd16() from the end: returns the length of the
+    //matching suffix, or the size of the blocks
+    __m128i low = _mm_loadu_si128((const __m128i *)cc->low);
+    __m128i high = _mm_loadu_si128((const __m128i *)cc->high);
+    size_t j;
+
+    for(j = len; j >= 16; j -= 16){
+        int m = sdscharclassmatch16(low, high, _mm_loadu_si128((const __m128i *)(p+j-16)));
+        int stop = (accept ? ~m : m) & 0xFFFF;
+        if(stop){
+            return len-(j-16+(31-__builtin_clz(stop)))-1;
+        }
     }
+    return len-j;
+}
+#endif
 
-    nlen = pend-pstart+1;
-    if(nlen<=0) nlen=0;
+static size_t sdscharclassfwd(const sdscharclass *cc, const char *p, size_t len, int accept){
+    //length of the prefix of p made of bytes whose membership is 'accept'
+    size_t j = 0;
+#if defined(SDS_CHARCLASS_SSSE3)
+    if(sdscharclassssse3()){
+        j = sdscharclassfwd16(cc, p, len, accept);
+        if(j < (len & ~(size_t)15)) return j;
+    }
+#endif
+    while(j < len && sdscharclasstest(cc, p[j]) == accept){
+        j++;
+    }
+    return j;
+}
 
-    if((nlen>0) && (pstart > sh->buf)){
-        memmove(sh->buf, pstart, nlen);
+static size_t sdscharclassbwd(const sdscharclass *cc, const char *p, size_t len, int accept){
+    //length of the suffix of p made of bytes whose membership is 'accept'
+    size_t j = len;
+#if defined(SDS_CHARCLASS_SSSE3)
+    if(sdscharclassssse3()){
+        size_t n = sdscharclassbwd16(cc, p, len, accept);
+        if(n < (len & ~(size_t)15)) return n;
+        j = len-n;
+    }
+#endif
+    while(j > 0 && sdscharclasstest(cc, p[j-1]) == accept){
+        j--;
+    }
+    return len-j;
+}
+
+sds sdstrim(sds str, const char *cset){
+    //remove the bytes in cset from both ends of str
+    sdshdr *sh = SDSGETHDR(str);
+    size_t head, tail = 0, nlen;
+    sdscharclass cc;
+
+    sdscharclassinit(&cc, cset, strlen(cset));
+    head = sdscharclassfwd(&cc, sh->buf, sh->len, 1);
+    if(head < sh->len){
+        tail = sdscharclassbwd(&cc, sh->buf+head, sh->len-head, 1);
+    }
+    nlen = sh->len-head-tail;
+
+    if((nlen>0) && (head>0)){
+        memmove(sh->buf, sh->buf+head, nlen);
     }
     sh->buf[nlen] = '\0';
+    sh->free += sh->len-nlen;
     sh->len = nlen;
-    sh->free = totlen-nlen;
 
     return sh->buf;
 }
 
+size_t sdsspan(const sds str, const char *cset){
+    //like strspn(), but embedded '\0' in str are scanned as well
+    sdscharclass cc;
+
+    sdscharclassinit(&cc, cset, strlen(cset));
+    return sdscharclassfwd(&cc, str, sdslen(str), 1);
+}
+
+size_t sdscspan(const sds str, const char *cset){
+    //like strcspn(), but embedded '\0' in str are scanned as well
+    sdscharclass cc;
+
+    sdscharclassinit(&cc, cset, strlen(cset));
+    return sdscharclassfwd(&cc, str, sdslen(str), 0);
+}
+
+sds sdsmapchars(sds str, const char *from, const char *to, size_t setlen){
+    //replace every byte from[i] in str with to[i], in one table driven pass.
+    //As in Redis the first occurrence of a byte in 'from' wins, so the
+    //table is filled backwards.
+    unsigned char map[256];
+    size_t j, len = sdslen(str);
+
+    for(j = 0; j < 256; j++){
+        map[j] = j;
+    }
+    for(j = setlen; j > 0; j--){
+        map[(unsigned char)from[j-1]] = to[j-1];
+    }
+    for(j = 0; j < len; j++){
+        str[j] = map[(unsigned char)str[j]];
+    }
+    return str;
+}
+
+size_t sdscountbyte(const sds str, char c){
+    //number of occurrences of c in str
+    size_t j = 0, count = 0, len = sdslen(str);
+#if defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(c);
+
+    for(; j+16 <= len; j += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(str+j));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+#endif
+    for(; j < len; j++){
+        count += (str[j] == c);
+    }
+    return count;
+}
+
 int sdscmp(sds str1, sds str2){
     //corresponding to strcmp for C strin
     //memcpy is used in source code
@@ -274,6 +492,90 @@ int sdscmp(sds str1, sds str2){
     return cmp;
 }
 
+/*----------------------ASCII case folding------------------------*/
+static inline unsigned char sdsfoldlower(unsigned char c){
+    //locale independent tolower(), only 'A'-'Z' are mapped
+    return (c >= 'A' && c <= 'Z') ? c+('a'-'A') : c;
+}
+
+#if defined(__SSE2__)
+static inline __m128i sdsfold16(__m128i v, char first){
+    //flip the case bit of the 16 bytes in [first, first+25]:
+    //the add moves that range to the bottom of the signed byte range
+    __m128i t = _mm_add_epi8(v, _mm_set1_epi8((char)(128-first)));
+    __m128i m = _mm_cmplt_epi8(t, _mm_set1_epi8(-128+26));
+    return _mm_xor_si128(v, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+}
+#endif
+
+static void sdsfoldcase(sds str, char first){
+    size_t j = 0, len = sdslen(str);
+#if defined(__SSE2__)
+    for(; j+16 <= len; j += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(str+j));
+        _mm_storeu_si128((__m128i *)(str+j), sdsfold16(v, first));
+    }
+#endif
+    for(; j < len; j++){
+        unsigned char c = str[j];
+        if(c >= (unsigned char)first && c <= (unsigned char)first+25){
+            str[j] = c^0x20;
+        }
+    }
+}
+
+void sdstolower(sds str){
+    //ASCII lowercase of the whole buf in place, bytes >= 128 are untouched
+    sdsfoldcase(str, 'A');
+}
+
+void sdstoupper(sds str){
+    //ASCII uppercase of the whole buf in place, bytes >= 128 are untouched
+    sdsfoldcase(str, 'a');
+}
+
+int sdscasecmp(const sds str1, const sds str2){
+    //like sdscmp, but 'A'-'Z' compare equal to 'a'-'z'
+    size_t len1 = sdslen(str1), len2 = sdslen(str2);
+    size_t slen = (len1>len2 ? len2 : len1), j = 0;
+
+#if defined(__SSE2__)
+    for(; j+16 <= slen; j += 16){
+        __m128i a = sdsfold16(_mm_loadu_si128((const __m128i *)(str1+j)), 'A');
+        __m128i b = sdsfold16(_mm_loadu_si128((const __m128i *)(str2+j)), 'A');
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if(mask != 0xFFFF){
+            //let the scalar loop below report the first mismatch
+            j += __builtin_ctz(~mask);
+            break;
+        }
+    }
+#endif
+    for(; j < slen; j++){
+        unsigned char c1 = sdsfoldlower(str1[j]), c2 = sdsfoldlower(str2[j]);
+        if(c1 != c2){
+            return c1-c2;
+        }
+    }
+    return (len1 > len2) - (len1 < len2);
+}
+
+unsigned int sdscasehash(const sds str, unsigned int seed){
+    //FNV-1a of the lowercased buf, so that strings equal for sdscasecmp
+    //hash to the same value
+    size_t j, len = sdslen(str);
+    unsigned int h = 2166136261U ^ seed;
+
+    for(j = 0; j < len; j++){
+        h ^= sdsfoldlower(str[j]);
+        h *= 16777619U;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6dU;
+    h ^= h >> 12;
+    return h;
+}
+
 int sdsll2str(char *s, long long value){
     /*turn long long value into string*/
     char *p, aux;
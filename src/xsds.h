@@ -23,6 +23,7 @@ sds sdsempty();
 size_t sdslen(const sds s);
 sds sdsdup(const sds s);
 void sdsfree(sds s);
+void sdsfree_deferred(sds s);
 size_t sdsavail(const sds s);
 void sdsupdatelen(sds s);
 sds sdsgrowzero(sds s, size_t len);
@@ -32,9 +33,17 @@ sds sdscatsds(sds s, sds t);
 sds sdscpylen(sds s, size_t len, char *str);
 sds sdscpy(sds s, char *str);
 sds sdstrim(sds s, const char *cset);
+size_t sdsspan(const sds s, const char *cset);
+size_t sdscspan(const sds s, const char *cset);
+sds sdsmapchars(sds s, const char *from, const char *to, size_t setlen);
+size_t sdscountbyte(const sds s, char c);
 sds sdsrange(sds s, int start, int end);
 void sdsclear(sds s);
 int sdscmp(const sds s1, const sds s2);
+int sdscasecmp(const sds s1, const sds s2);
+unsigned int sdscasehash(const sds s, unsigned int seed);
+void sdstolower(sds s);
+void sdstoupper(sds s);
 sds sdsfromlonglong(long long value);
 
 sds sdscatvprintf(sds s, const char *fmt, va_list ap);
@@ -48,6 +57,7 @@ sds sdsMakeRoomFor(sds s, size_t addlen);
 void sdsIncrLen(sds s, int incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
+void sdsSetLatencyHooks(unsigned long long (*start)(void), void (*end)(unsigned long long start));
 
 #endif
 
@@ -41,6 +41,7 @@ void zlibc_free(void *ptr) {
 
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include "config.h"
 #include "zmalloc.h"
 
@@ -120,11 +121,29 @@ static void zmalloc_default_oom(size_t size) {
 }
 
 static void (*zmalloc_oom_handler)(size_t) = zmalloc_default_oom;
+static unsigned long long (*zmalloc_latency_start_hook)(void) = NULL;
+static void (*zmalloc_latency_end_hook)(int, unsigned long long) = NULL;
+
+/* Without hooks, or for small sizes, timing costs one test. The start hook
+ * may return 0 to skip a sample. */
+#define zmalloc_latency_start(var,size) do { \
+    unsigned long long (*_start)(void) = zmalloc_latency_start_hook; \
+    var = (_start && (size) >= ZMALLOC_LATENCY_MIN_SIZE) ? _start() : 0; \
+} while(0)
+
+#define zmalloc_latency_end(event,var) do { \
+    void (*_end)(int, unsigned long long) = zmalloc_latency_end_hook; \
+    if ((var) && _end) _end((event),(var)); \
+} while(0)
 
 void *zmalloc(size_t size) {
-    void *ptr = malloc(size+PREFIX_SIZE);
+    unsigned long long latency;
+    void *ptr;
 
+    zmalloc_latency_start(latency,size);
+    ptr = malloc(size+PREFIX_SIZE);
     if (!ptr) zmalloc_oom_handler(size);
+    zmalloc_latency_end(ZMALLOC_EVENT_MALLOC,latency);
 #ifdef HAVE_MALLOC_SIZE
     update_zmalloc_stat_alloc(zmalloc_size(ptr));
     return ptr;
@@ -136,9 +155,13 @@ void *zmalloc(size_t size) {
 }
 
 void *zcalloc(size_t size) {
-    void *ptr = calloc(1, size+PREFIX_SIZE);
+    unsigned long long latency;
+    void *ptr;
 
+    zmalloc_latency_start(latency,size);
+    ptr = calloc(1, size+PREFIX_SIZE);
     if (!ptr) zmalloc_oom_handler(size);
+    zmalloc_latency_end(ZMALLOC_EVENT_MALLOC,latency);
 #ifdef HAVE_MALLOC_SIZE
     update_zmalloc_stat_alloc(zmalloc_size(ptr));
     return ptr;
@@ -155,12 +178,15 @@ void *zrealloc(void *ptr, size_t size) {
 #endif
     size_t oldsize;
     void *newptr;
+    unsigned long long latency;
 
     if (ptr == NULL) return zmalloc(size);
+    zmalloc_latency_start(latency,size);
 #ifdef HAVE_MALLOC_SIZE
     oldsize = zmalloc_size(ptr);
     newptr = realloc(ptr,size);
     if (!newptr) zmalloc_oom_handler(size);
+    zmalloc_latency_end(ZMALLOC_EVENT_REALLOC,latency);
 
     update_zmalloc_stat_free(oldsize);
     update_zmalloc_stat_alloc(zmalloc_size(newptr));
@@ -170,6 +196,7 @@ void *zrealloc(void *ptr, size_t size) {
     oldsize = *((size_t*)realptr);
     newptr = realloc(realptr,size+PREFIX_SIZE);
     if (!newptr) zmalloc_oom_handler(size);
+    zmalloc_latency_end(ZMALLOC_EVENT_REALLOC,latency);
 
     *((size_t*)newptr) = size;
     update_zmalloc_stat_free(oldsize);
@@ -241,10 +268,225 @@ void zmalloc_enable_thread_safeness(void) {
     zmalloc_thread_safe = 1;
 }
 
+void zmalloc_set_latency_hooks(unsigned long long (*start)(void),
+                               void (*end)(int event, unsigned long long start)) {
+    /* The end hook is installed first and removed last, so that a sample
+     * started by the start hook always finds it. */
+    if (start) zmalloc_latency_end_hook = end;
+    zmalloc_latency_start_hook = start;
+    if (!start) zmalloc_latency_end_hook = end;
+}
+
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
     zmalloc_oom_handler = oom_handler;
 }
 
+/* ------------------------- Deferred reclamation ----------------------------
+ *
+ * Readers that access shared objects without taking locks wrap the access
+ * between zmalloc_epoch_enter() and zmalloc_epoch_leave(). Writers that unlink
+ * such an object release it with zfree_deferred() instead of zfree(): the
+ * pointer is parked in a per thread batch tagged with the global epoch, and
+ * it is actually freed only once the global epoch moved two steps forward.
+ *
+ * The global epoch advances only when every thread inside a critical section
+ * has already observed the current value, so two steps guarantee that no
+ * reader that could have seen the object is still running. */
+
+#define ZEPOCH_BATCH_SIZE 64
+
+typedef struct zepochBatch {
+    struct zepochBatch *next;
+    unsigned long epoch;    /* Epoch of the most recent pointer retired. */
+    int count;
+    void *ptrs[ZEPOCH_BATCH_SIZE];
+} zepochBatch;
+
+typedef struct zepochThread {
+    struct zepochThread *next;  /* Registered threads, never unlinked. */
+    unsigned long state;        /* Observed epoch << 1 | active flag. */
+    int in_use;                 /* Owned by a running thread. */
+    int nesting;                /* Critical section nesting, owner only. */
+    zepochBatch *current;       /* Batch being filled. */
+    zepochBatch *head, *tail;   /* Sealed batches, oldest first. */
+} zepochThread;
+
+static unsigned long zepoch_global = 0;
+static size_t deferred_memory = 0;
+static zepochThread *zepoch_threads = NULL;
+static zepochBatch *zepoch_orphans = NULL;
+static pthread_mutex_t zepoch_orphans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t zepoch_key;
+static pthread_once_t zepoch_key_once = PTHREAD_ONCE_INIT;
+static __thread zepochThread *zepoch_self = NULL;
+
+/* Called when a thread exits: its pending batches are handed to the orphan
+ * list, reclaimed later by whatever thread calls zmalloc_epoch_reclaim(). */
+static void zepochThreadExit(void *arg) {
+    zepochThread *t = arg;
+    zepochBatch *b, *next;
+
+    if (t->current) {
+        t->current->next = NULL;
+        if (t->tail) t->tail->next = t->current;
+        else t->head = t->current;
+        t->tail = t->current;
+        t->current = NULL;
+    }
+    pthread_mutex_lock(&zepoch_orphans_mutex);
+    for (b = t->head; b; b = next) {
+        next = b->next;
+        b->next = zepoch_orphans;
+        zepoch_orphans = b;
+    }
+    pthread_mutex_unlock(&zepoch_orphans_mutex);
+    t->head = t->tail = NULL;
+    t->nesting = 0;
+    __atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&t->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void zepochCreateKey(void) {
+    pthread_key_create(&zepoch_key, zepochThreadExit);
+}
+
+/* Return the record of the calling thread, registering it on first use.
+ * Records of exited threads are recycled before allocating new ones. */
+static zepochThread *zepochSelf(void) {
+    zepochThread *t;
+
+    if (zepoch_self) return zepoch_self;
+    pthread_once(&zepoch_key_once, zepochCreateKey);
+
+    for (t = __atomic_load_n(&zepoch_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&t->in_use, &expected, 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (t == NULL) {
+        t = zcalloc(sizeof(*t));
+        t->in_use = 1;
+        t->next = __atomic_load_n(&zepoch_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&zepoch_threads, &t->next, t, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(zepoch_key, t);
+    zepoch_self = t;
+    return t;
+}
+
+void zmalloc_epoch_enter(void) {
+    zepochThread *t = zepochSelf();
+
+    if (t->nesting++ == 0) {
+        unsigned long e = __atomic_load_n(&zepoch_global, __ATOMIC_ACQUIRE);
+        /* Full barrier: the epoch must be published before any shared
+         * pointer is loaded inside the critical section. */
+        __atomic_store_n(&t->state, (e << 1) | 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void zmalloc_epoch_leave(void) {
+    zepochThread *t = zepoch_self;
+
+    if (t == NULL || t->nesting == 0) return;
+    if (--t->nesting == 0)
+        __atomic_store_n(&t->state, t->state & ~1UL, __ATOMIC_RELEASE);
+}
+
+/* Advance the global epoch if every active reader already observed it. */
+static unsigned long zepochTryAdvance(void) {
+    unsigned long e = __atomic_load_n(&zepoch_global, __ATOMIC_SEQ_CST);
+    zepochThread *t;
+
+    for (t = __atomic_load_n(&zepoch_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        unsigned long s = __atomic_load_n(&t->state, __ATOMIC_SEQ_CST);
+        if ((s & 1) && (s >> 1) != e) return e;
+    }
+    if (__atomic_compare_exchange_n(&zepoch_global, &e, e+1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) e++;
+    return e;
+}
+
+static void zepochFreeBatch(zepochBatch *b) {
+    size_t bytes = 0;
+    int j;
+
+    for (j = 0; j < b->count; j++) {
+        bytes += zmalloc_size(b->ptrs[j]);
+        zfree(b->ptrs[j]);
+    }
+    __atomic_sub_fetch(&deferred_memory, bytes, __ATOMIC_RELAXED);
+    zfree(b);
+}
+
+/* Free every batch retired by the calling thread (and by exited threads)
+ * that no reader can reference anymore. Writers call it implicitly every
+ * ZEPOCH_BATCH_SIZE deferred frees, but it can be called at any time, for
+ * instance from a periodic cron. */
+void zmalloc_epoch_reclaim(void) {
+    zepochThread *t = zepochSelf();
+    unsigned long e = zepochTryAdvance();
+    zepochBatch *b, **link;
+
+    while (t->head && t->head->epoch + 2 <= e) {
+        b = t->head;
+        t->head = b->next;
+        if (t->head == NULL) t->tail = NULL;
+        zepochFreeBatch(b);
+    }
+    if (t->head == NULL && t->current && t->current->epoch + 2 <= e) {
+        zepochFreeBatch(t->current);
+        t->current = NULL;
+    }
+
+    if (__atomic_load_n(&zepoch_orphans, __ATOMIC_RELAXED) == NULL ||
+        pthread_mutex_trylock(&zepoch_orphans_mutex) != 0) return;
+    link = &zepoch_orphans;
+    while ((b = *link) != NULL) {
+        if (b->epoch + 2 <= e) {
+            *link = b->next;
+            zepochFreeBatch(b);
+        } else {
+            link = &b->next;
+        }
+    }
+    pthread_mutex_unlock(&zepoch_orphans_mutex);
+}
+
+void zfree_deferred(void *ptr) {
+    zepochThread *t;
+    zepochBatch *b;
+
+    if (ptr == NULL) return;
+    t = zepochSelf();
+    b = t->current;
+    if (b == NULL) {
+        b = t->current = zmalloc(sizeof(*b));
+        b->next = NULL;
+        b->count = 0;
+    }
+    /* The batch is tagged with the newest epoch, so the whole batch is held
+     * until the last pointer added to it is safe to free. */
+    b->epoch = __atomic_load_n(&zepoch_global, __ATOMIC_SEQ_CST);
+    b->ptrs[b->count++] = ptr;
+    __atomic_add_fetch(&deferred_memory, zmalloc_size(ptr), __ATOMIC_RELAXED);
+
+    if (b->count == ZEPOCH_BATCH_SIZE) {
+        if (t->tail) t->tail->next = b;
+        else t->head = b;
+        t->tail = b;
+        t->current = NULL;
+        zmalloc_epoch_reclaim();
+    }
+}
+
+/* Bytes retired with zfree_deferred() and still waiting to be freed. They are
+ * also part of zmalloc_used_memory(), since they are still allocated. */
+size_t zmalloc_deferred_memory(void) {
+    return __atomic_load_n(&deferred_memory, __ATOMIC_RELAXED);
+}
+
 /* Get the RSS information in an OS-specific way.
  *
  * WARNING: the function zmalloc_get_rss() is not designed to be fast
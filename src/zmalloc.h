@@ -65,6 +65,14 @@
 #define ZMALLOC_LIB "libc"
 #endif
 
+/* Allocations of at least ZMALLOC_LATENCY_MIN_SIZE bytes are timed once
+ * latency hooks are installed: the start hook returns a timestamp, or 0 to
+ * skip the sample, and the end hook receives one of the events below with
+ * that timestamp. */
+#define ZMALLOC_LATENCY_MIN_SIZE (64*1024)
+#define ZMALLOC_EVENT_MALLOC 0      /* zmalloc/zcalloc */
+#define ZMALLOC_EVENT_REALLOC 1     /* zrealloc */
+
 void *zmalloc(size_t size);
 void *zcalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
@@ -73,11 +81,18 @@ char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
 void zmalloc_enable_thread_safeness(void);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
+void zmalloc_set_latency_hooks(unsigned long long (*start)(void),
+                               void (*end)(int event, unsigned long long start));
 float zmalloc_get_fragmentation_ratio(size_t rss);
 size_t zmalloc_get_rss(void);
 size_t zmalloc_get_private_dirty(void);
 size_t zmalloc_get_smap_bytes_by_field(char *field);
 void zlibc_free(void *ptr);
+void zfree_deferred(void *ptr);
+void zmalloc_epoch_enter(void);
+void zmalloc_epoch_leave(void);
+void zmalloc_epoch_reclaim(void);
+size_t zmalloc_deferred_memory(void);
 
 #ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);